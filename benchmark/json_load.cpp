@@ -0,0 +1,57 @@
+#include "json.h"
+#include "json_view.h"
+#include "mapped_file.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Array of copies of the given document, so that the benchmark input is large enough
+string ScaleDocument(string_view document, size_t copy_count) {
+    string result = "[";
+    for (size_t copy_idx = 0; copy_idx < copy_count; ++copy_idx) {
+        if (copy_idx > 0) {
+            result += ", ";
+        }
+        result += document;
+    }
+    result += "]";
+    return result;
+}
+
+template<typename LoadFunc>
+void Measure(string_view name, const string &data, LoadFunc load) {
+    const auto start = chrono::steady_clock::now();
+    const auto document = load();
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cout << name << ": " << elapsed.count() * 1000 << " ms, "
+         << data.size() / elapsed.count() / (1 << 20) << " MB/s, "
+         << document.GetRoot().AsArray().size() << " documents" << endl;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        cerr << "Usage: json_load_benchmark <document.json> [copy_count]\n";
+        return 5;
+    }
+    const MappedFile input_file(argv[1]);
+    const size_t copy_count = argc == 3 ? stoul(argv[2]) : 100;
+    const string data = ScaleDocument(input_file.GetData(), copy_count);
+
+    Measure("istream", data, [&data] {
+        istringstream input(data);
+        return Json::Load(input);
+    });
+    Measure("buffer", data, [&data] {
+        return Json::Load(string_view(data));
+    });
+    Measure("arena view", data, [&data] {
+        return Json::View::Load(data);
+    });
+
+    return 0;
+}
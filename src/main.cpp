@@ -1,69 +1,318 @@
 #include "descriptions.h"
 #include "json.h"
+#include "json_view.h"
+#include "mapped_file.h"
 #include "requests.h"
+#include "server.h"
 #include "transport_catalog.h"
+#include "utils.h"
 
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <optional>
 #include <string_view>
+#include <system_error>
+#include <unordered_map>
 
 using namespace std;
 
-string ReadFileData(const string &file_name) {
-    ifstream file(file_name, ios::binary | ios::ate);
-    const ifstream::pos_type end_pos = file.tellg();
-    file.seekg(0, ios::beg);
+using Options = unordered_map<string_view, string_view>;
 
-    string data(end_pos, '\0');
-    file.read(&data[0], end_pos);
+// Options are passed as --name or --name=value after the mode
+Options ParseOptions(int argc, const char *argv[]) {
+    Options options;
+    for (int arg_idx = 2; arg_idx < argc; ++arg_idx) {
+        string_view arg(argv[arg_idx]);
+        if (arg.substr(0, 2) != "--") {
+            continue;
+        }
+        arg.remove_prefix(2);
+        const size_t eq_pos = arg.find('=');
+        if (eq_pos == string_view::npos) {
+            options[arg] = "";
+        } else {
+            options[arg.substr(0, eq_pos)] = arg.substr(eq_pos + 1);
+        }
+    }
+    return options;
+}
+
+string ReadAll(istream &input) {
+    string data;
+    char buffer[1 << 16];
+    while (input.read(buffer, sizeof(buffer)) || input.gcount() > 0) {
+        data.append(buffer, input.gcount());
+    }
     return data;
 }
 
+// Text of the input document, Json::View nodes point into it
+class InputData {
+ public:
+    explicit InputData(const Options &options) {
+        if (const auto it = options.find("input"); it != options.end()) {
+            file_.emplace(string(it->second));
+        } else {
+            data_ = ReadAll(cin);
+        }
+    }
+
+    string_view Get() const {
+        return file_ ? file_->GetData() : string_view(data_);
+    }
+
+ private:
+    optional<MappedFile> file_;
+    string data_;
+};
+
+// Text of the top-level members of the input document. Each one is parsed only when it is needed,
+// stat_requests are answered while being read no matter where they are in the document
+using InputSections = unordered_map<string, string_view>;
+
+InputSections SplitInput(string_view input) {
+    InputSections sections;
+    Json::View::Reader reader(input);
+    if (reader.EnterObject()) {
+        while (auto key = reader.NextKey()) {
+            sections[move(*key)] = reader.SkipValue();
+        }
+    }
+    return sections;
+}
+
+Json::Node LoadSettings(const InputSections &sections, const string &name) {
+    return Json::View::Load(sections.at(name)).GetRoot().ToNode();
+}
+
+// --<name>=<n> asks for n, plain --<name> for one per core
+size_t GetCount(const Options &options, string_view name) {
+    const auto it = options.find(name);
+    if (it == options.end()) {
+        return 1;
+    }
+    return it->second.empty() ? GetWorkerCount() : max<size_t>(1, stoul(string(it->second)));
+}
+
+// --threads=<n> answers stat requests on n threads, plain --threads on all cores
+size_t GetThreadCount(const Options &options) {
+    return GetCount(options, "threads");
+}
+
+unique_ptr<ThreadPool> MakeThreadPool(const Options &options) {
+    const size_t thread_count = GetThreadCount(options);
+    return thread_count > 1 ? make_unique<ThreadPool>(thread_count) : nullptr;
+}
+
+// --cache=<MB> caches responses in that much memory, plain --cache in 64 MB, no cache without it
+size_t GetCacheSize(const Options &options) {
+    static constexpr size_t DEFAULT_CACHE_SIZE_MB = 64;
+    const auto it = options.find("cache");
+    if (it == options.end()) {
+        return 0;
+    }
+    return (it->second.empty() ? DEFAULT_CACHE_SIZE_MB : stoul(string(it->second))) << 20;
+}
+
+unique_ptr<Requests::ResponseCache> MakeResponseCache(const Options &options) {
+    const size_t cache_size = GetCacheSize(options);
+    return cache_size > 0 ? make_unique<Requests::ResponseCache>(cache_size) : nullptr;
+}
+
+void PrintTimings(const SectionTimings &timings, ostream &output) {
+    for (const auto &[section, duration] : timings) {
+        output << section << ": " << chrono::duration_cast<chrono::microseconds>(duration).count() << " us\n";
+    }
+}
+
+// --stats prints the counters of the answered requests to stderr once the mode is done, whichever way main returns
+class StatsPrinter {
+ public:
+    explicit StatsPrinter(const Options &options) : is_enabled_(options.count("stats") > 0) {}
+
+    ~StatsPrinter() {
+        if (is_enabled_) {
+            Requests::PrintStats(cerr);
+        }
+    }
+
+ private:
+    bool is_enabled_;
+};
+
+// --disk-cache=<file> keeps responses in the file across runs, plain --disk-cache in <base file>.responses
+unique_ptr<Requests::DiskResponseCache> MakeDiskResponseCache(
+    const Options &options, const string &base_file_name, const Requests::DiskResponseCache::BaseVersion &base_version
+) {
+    const auto it = options.find("disk-cache");
+    if (it == options.end()) {
+        return nullptr;
+    }
+    const string file_name = it->second.empty() ? base_file_name + ".responses" : string(it->second);
+    return make_unique<Requests::DiskResponseCache>(file_name, base_version);
+}
+
+// Readers of the file, e.g. serve reloading the base, see either the old contents or the new ones
+void WriteFileAtomically(const string &file_name, string_view data) {
+    const string temp_file_name = file_name + ".tmp";
+    {
+        ofstream file(temp_file_name, ios::binary);
+        if (!file.write(data.data(), data.size()).flush()) {
+            throw system_error(errno, generic_category(), "can't write " + temp_file_name);
+        }
+    }
+    if (rename(temp_file_name.c_str(), file_name.c_str()) != 0) {
+        throw system_error(errno, generic_category(), "can't replace " + file_name);
+    }
+}
+
+// Catalog doesn't refer to the base data after decoding, so the file is unmapped right away.
+// The version of the file is taken from the same mapping, so it matches the loaded base
+TransportCatalog LoadBase(const string &file_name, const Options &options,
+                          Requests::DiskResponseCache::BaseVersion *base_version = nullptr) {
+    const MappedFile base_file(file_name);
+    if (base_version) {
+        *base_version = {ComputeHash(base_file.GetData()), base_file.GetData().size(), base_file.GetModificationTime()};
+    }
+    SectionTimings timings;
+    auto db = TransportCatalog::Deserialize(base_file.GetData(), timings);
+    if (options.count("load-timings")) {
+        PrintTimings(timings, cerr);
+    }
+    return db;
+}
+
 int main(int argc, const char *argv[]) {
-    string_view usage = "Usage: transport_catalog [make_base|process_requests|online]\n";
-    if (argc != 2) {
+    string_view usage = "Usage: transport_catalog [make_base|process_requests|process_binary_requests|online|serve] [options]\n"
+                        "Options:\n"
+                        "  --base=<file>      base to answer requests from (process_binary_requests, serve)\n"
+                        "  --cache[=<MB>]     cache Stop, Bus, Route and Map responses, 64 MB if the size is omitted (process_requests, online, serve)\n"
+                        "  --disk-cache[=<file>] keep responses in the file across runs of the same base, <base>.responses if omitted (process_requests)\n"
+                        "  --encode-responses store encoded Stop and Bus responses in the base (make_base)\n"
+                        "  --input=<file>     read input document from the file instead of stdin\n"
+                        "  --load-timings     print per-section base decode times to stderr (modes that read a base)\n"
+                        "  --previous=<file>  reuse unchanged parts of a previous base (make_base)\n"
+                        "  --save-timings     print per-section base encode times to stderr (make_base)\n"
+                        "  --stats            print latency percentiles and counters of answered requests to stderr at exit\n"
+                        "  --socket=<path>    serve clients of the Unix domain socket instead of stdin (serve)\n"
+                        "  --threads[=<n>]    answer stat requests on n threads, all cores if n is omitted (process_requests, online, serve)\n"
+                        "  --workers[=<n>]    serve the socket by n processes sharing the base, one per core if n is omitted (serve)\n";
+    if (argc < 2) {
         cerr << usage;
         return 5;
     }
 
     const string_view mode(argv[1]);
+    const auto options = ParseOptions(argc, argv);
+    const StatsPrinter stats_printer(options);
+
+    if (mode == "process_binary_requests" || mode == "serve") {
+        // Requests are not a single JSON document here, so the base file name comes from the options
+        const auto base_it = options.find("base");
+        if (base_it == options.end()) {
+            cerr << usage;
+            return 1;
+        }
+        const string base_file_name(base_it->second);
 
-    const auto input_doc = Json::Load(cin);
-    const auto &input_map = input_doc.GetRoot().AsMap();
+        if (mode == "serve") {
+            // make_base replaces the file atomically, so SIGHUP after it picks up the new base
+            Server::RequestServer server([&base_file_name, &options] {
+                return make_shared<const TransportCatalog>(LoadBase(base_file_name, options));
+            }, GetThreadCount(options), GetCacheSize(options));
+            const auto socket_it = options.find("socket");
+            if (options.count("workers")) {
+                if (socket_it == options.end()) {
+                    cerr << usage;
+                    return 1;
+                }
+                server.ServeWorkers(string(socket_it->second), GetCount(options, "workers"));
+                return 0;
+            }
+            server.ReloadOnSignal(SIGHUP);
+            if (socket_it != options.end()) {
+                server.ServeSocket(string(socket_it->second));
+            } else {
+                server.Serve(cin, cout);
+            }
+            return 0;
+        }
+
+        const auto db = LoadBase(base_file_name, options);
+        if (const auto it = options.find("input"); it != options.end()) {
+            ifstream input{string(it->second), ios::binary};
+            if (!input) {
+                cerr << "can't open " << it->second << '\n';
+                return 1;
+            }
+            Requests::ProcessBinaryStream(db, input, cout);
+        } else {
+            Requests::ProcessBinaryStream(db, cin, cout);
+        }
+        return 0;
+    }
+
+    const InputData input_data(options);
+    const auto sections = SplitInput(input_data.Get());
 
     if (mode == "process_requests") {
-        const string &file_name = input_map.at("serialization_settings").AsMap().at("file").AsString();
-        const auto db = TransportCatalog::Deserialize(ReadFileData(file_name));
+        const string file_name = LoadSettings(sections, "serialization_settings").AsMap().at("file").AsString();
+        Requests::DiskResponseCache::BaseVersion base_version{};
+        const auto db = LoadBase(file_name, options, &base_version);
 
-        Json::PrintValue(
-            Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),
-            cout
-        );
-        cout << endl;
+        const auto cache = MakeResponseCache(options);
+        const auto disk_cache = MakeDiskResponseCache(options, file_name, base_version);
+        const auto pool = MakeThreadPool(options);
+        Json::View::Reader stat_requests(sections.at("stat_requests"));
+        Requests::ProcessStream(db, stat_requests, cout, pool.get(), cache.get(), disk_cache.get());
+        cout << '\n';
 
     } else if (mode == "make_base") {
-        const TransportCatalog db(
-            Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
-            input_map.at("routing_settings").AsMap(),
-            input_map.at("render_settings").AsMap()
+        optional<TransportCatalog> previous_db;
+        if (const auto it = options.find("previous"); it != options.end()) {
+            const MappedFile previous_file{string(it->second)};
+            previous_db = TransportCatalog::Deserialize(previous_file.GetData());
+        }
+        const auto routing_settings = LoadSettings(sections, "routing_settings");
+        const auto render_settings = LoadSettings(sections, "render_settings");
+        TransportCatalog db(
+            Descriptions::ReadDescriptions(sections.at("base_requests")),
+            routing_settings.AsMap(),
+            render_settings.AsMap(),
+            previous_db ? &*previous_db : nullptr
         );
+        if (options.count("encode-responses")) {
+            Requests::EncodeResponses(db);
+        }
+
+        SectionTimings timings;
+        const string base_data = db.Serialize(timings);
+        if (options.count("save-timings")) {
+            PrintTimings(timings, cerr);
+        }
 
-        const string &file_name = input_map.at("serialization_settings").AsMap().at("file").AsString();
-        ofstream file(file_name);
-        file << db.Serialize();
+        const string file_name = LoadSettings(sections, "serialization_settings").AsMap().at("file").AsString();
+        WriteFileAtomically(file_name, base_data);
 
     } else if (mode == "online") {
+        const auto routing_settings = LoadSettings(sections, "routing_settings");
+        const auto render_settings = LoadSettings(sections, "render_settings");
         const TransportCatalog db(
-            Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
-            input_map.at("routing_settings").AsMap(),
-            input_map.at("render_settings").AsMap()
+            Descriptions::ReadDescriptions(sections.at("base_requests")),
+            routing_settings.AsMap(),
+            render_settings.AsMap()
         );
 
-        Json::PrintValue(
-            Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),
-            cout
-        );
-        cout << endl;
+        const auto cache = MakeResponseCache(options);
+        const auto pool = MakeThreadPool(options);
+        Json::View::Reader stat_requests(sections.at("stat_requests"));
+        Requests::ProcessStream(db, stat_requests, cout, pool.get(), cache.get());
+        cout << '\n';
     } else {
         cerr << usage;
         return 1;
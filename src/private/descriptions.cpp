@@ -1,30 +1,78 @@
 #include "descriptions.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <iterator>
 
 using namespace std;
 
 namespace Descriptions {
 
-Stop Stop::ParseFrom(const Json::Dict &attrs) {
+// Both DOMs share the interface, string views of Json::View are copied explicitly
+template<typename DictType>
+static Stop ParseStop(const DictType &attrs) {
     Stop stop = {
-        .name = attrs.at("name").AsString(),
+        .name = string(attrs.at("name").AsString()),
         .position = {
             .latitude = attrs.at("latitude").AsDouble(),
             .longitude = attrs.at("longitude").AsDouble(),
-        }
+        },
+        .distances = {},
     };
     if (attrs.count("road_distances") > 0) {
         for (const auto&[neighbour_stop, distance_node] : attrs.at("road_distances").AsMap()) {
-            stop.distances[neighbour_stop] = distance_node.AsInt();
+            stop.distances[string(neighbour_stop)] = distance_node.AsInt();
         }
     }
     return stop;
 }
 
-static vector<string> ParseStops(const Json::Array &stop_nodes, bool is_roundtrip) {
+Stop Stop::ParseFrom(const Json::Dict &attrs) {
+    return ParseStop(attrs);
+}
+
+Stop Stop::ParseFrom(const Json::View::Dict &attrs) {
+    return ParseStop(attrs);
+}
+
+void Stop::Serialize(TCProto::StopDescription &proto) const {
+    proto.set_name(name);
+    proto.set_latitude(position.latitude);
+    proto.set_longitude(position.longitude);
+    auto &distances_proto = *proto.mutable_distances();
+    for (const auto&[neighbour_stop, distance] : distances) {
+        distances_proto[neighbour_stop] = distance;
+    }
+}
+
+Stop Stop::Deserialize(const TCProto::StopDescription &proto) {
+    Stop stop = {
+        .name = proto.name(),
+        .position = {
+            .latitude = proto.latitude(),
+            .longitude = proto.longitude(),
+        },
+        .distances = {},
+    };
+    for (const auto&[neighbour_stop, distance] : proto.distances()) {
+        stop.distances[neighbour_stop] = distance;
+    }
+    return stop;
+}
+
+bool operator==(const Stop &lhs, const Stop &rhs) {
+    return lhs.name == rhs.name
+           && lhs.position.latitude == rhs.position.latitude
+           && lhs.position.longitude == rhs.position.longitude
+           && lhs.distances == rhs.distances;
+}
+
+template<typename ArrayType>
+static vector<string> ParseStops(const ArrayType &stop_nodes, bool is_roundtrip) {
     vector<string> stops;
     stops.reserve(stop_nodes.size());
-    for (const Json::Node &stop_node : stop_nodes) {
-        stops.push_back(stop_node.AsString());
+    for (const auto &stop_node : stop_nodes) {
+        stops.emplace_back(stop_node.AsString());
     }
     if (is_roundtrip || stops.size() <= 1) {
         return stops;
@@ -44,16 +92,17 @@ size_t ComputeStopsDistance(const Stop &lhs, const Stop &rhs) {
     }
 }
 
-Bus Bus::ParseFrom(const Json::Dict &attrs) {
-    const auto &name = attrs.at("name").AsString();
+template<typename DictType>
+static Bus ParseBus(const DictType &attrs) {
+    const string name(attrs.at("name").AsString());
     const auto &stops = attrs.at("stops").AsArray();
     if (stops.empty()) {
-        return Bus{.name = name};
+        return Bus{.name = name, .stops = {}, .endpoints = {}};
     } else {
         Bus bus{
             .name = name,
             .stops = ParseStops(stops, attrs.at("is_roundtrip").AsBool()),
-            .endpoints = {stops.front().AsString(), stops.back().AsString()}
+            .endpoints = {string(stops.front().AsString()), string(stops.back().AsString())}
         };
         if (bus.endpoints.back() == bus.endpoints.front()) {
             bus.endpoints.pop_back();
@@ -62,6 +111,14 @@ Bus Bus::ParseFrom(const Json::Dict &attrs) {
     }
 }
 
+Bus Bus::ParseFrom(const Json::Dict &attrs) {
+    return ParseBus(attrs);
+}
+
+Bus Bus::ParseFrom(const Json::View::Dict &attrs) {
+    return ParseBus(attrs);
+}
+
 void Bus::Serialize(TCProto::BusDescription &proto) const {
     proto.set_name(name);
     for (const string &stop : stops) {
@@ -89,19 +146,97 @@ Bus Bus::Deserialize(const TCProto::BusDescription &proto) {
     return bus;
 }
 
-vector<InputQuery> ReadDescriptions(const Json::Array &nodes) {
+bool operator==(const Bus &lhs, const Bus &rhs) {
+    return lhs.name == rhs.name && lhs.stops == rhs.stops && lhs.endpoints == rhs.endpoints;
+}
+
+template<typename DictType>
+static InputQuery ReadDescription(const DictType &node_dict) {
+    if (node_dict.at("type").AsString() == "Bus") {
+        return Bus::ParseFrom(node_dict);
+    } else {
+        return Stop::ParseFrom(node_dict);
+    }
+}
+
+template<typename ArrayType>
+static vector<InputQuery> ReadDescriptionsImpl(const ArrayType &nodes) {
     vector<InputQuery> result;
     result.reserve(nodes.size());
 
-    for (const Json::Node &node : nodes) {
-        const auto &node_dict = node.AsMap();
-        if (node_dict.at("type").AsString() == "Bus") {
-            result.emplace_back(Bus::ParseFrom(node_dict));
+    for (const auto &node : nodes) {
+        result.push_back(ReadDescription(node.AsMap()));
+    }
+
+    return result;
+}
+
+vector<InputQuery> ReadDescriptions(const Json::Array &nodes) {
+    return ReadDescriptionsImpl(nodes);
+}
+
+vector<InputQuery> ReadDescriptions(const Json::View::Array &nodes) {
+    return ReadDescriptionsImpl(nodes);
+}
+
+vector<InputQuery> ReadDescriptions(Json::View::Reader &nodes) {
+    vector<InputQuery> result;
+    if (nodes.EnterArray()) {
+        while (nodes.NextItem()) {
+            const auto node_doc = nodes.ReadValue();
+            result.push_back(ReadDescription(node_doc.GetRoot().AsMap()));
+        }
+    }
+    return result;
+}
+
+vector<InputQuery> ReadDescriptions(string_view nodes_text) {
+    const size_t worker_count = GetWorkerCount();
+    if (worker_count == 1) {
+        // Pre-pass would only add work
+        Json::View::Reader nodes(nodes_text);
+        return ReadDescriptions(nodes);
+    }
+
+    // Items are parsed one by one here as well, so that the workers together hold only worker_count items
+    const auto items = Json::View::SplitArray(nodes_text);
+    auto chunks = TransformChunksParallel(items.size(), worker_count, [&items](size_t begin, size_t end) {
+        vector<InputQuery> chunk;
+        chunk.reserve(end - begin);
+        for (size_t item_idx = begin; item_idx < end; ++item_idx) {
+            const auto node_doc = Json::View::Load(items[item_idx]);
+            chunk.push_back(ReadDescription(node_doc.GetRoot().AsMap()));
+        }
+        return chunk;
+    });
+
+    vector<InputQuery> result;
+    result.reserve(items.size());
+    for (auto &chunk : chunks) {
+        move(begin(chunk), end(chunk), back_inserter(result));
+    }
+    return result;
+}
+
+void SerializeDescriptions(const vector<InputQuery> &descriptions, TCProto::InputDescriptions &proto) {
+    for (const auto &item : descriptions) {
+        if (holds_alternative<Stop>(item)) {
+            get<Stop>(item).Serialize(*proto.add_stops());
         } else {
-            result.emplace_back(Stop::ParseFrom(node_dict));
+            get<Bus>(item).Serialize(*proto.add_buses());
         }
     }
+}
 
+vector<InputQuery> DeserializeDescriptions(const TCProto::InputDescriptions &proto) {
+    vector<InputQuery> result;
+    result.reserve(proto.stops_size() + proto.buses_size());
+    for (const auto &stop_proto : proto.stops()) {
+        result.emplace_back(Stop::Deserialize(stop_proto));
+    }
+    for (const auto &bus_proto : proto.buses()) {
+        result.emplace_back(Bus::Deserialize(bus_proto));
+    }
     return result;
 }
 
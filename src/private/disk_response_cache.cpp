@@ -0,0 +1,182 @@
+#include "disk_response_cache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <system_error>
+
+using namespace std;
+
+namespace Requests {
+
+// Has to change whenever the layout of the file or the format of the responses does
+static const string_view FILE_MAGIC = "TCRESP02";
+
+struct RecordHeader {
+    uint32_t key_size;
+    uint32_t text_size;
+    uint32_t request_id_pos;
+};
+
+static system_error MakeSystemError(const string &what) {
+    return system_error(errno, generic_category(), what);
+}
+
+static bool WriteAll(int fd, string_view data) {
+    while (!data.empty()) {
+        const ssize_t written = write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(written);
+    }
+    return true;
+}
+
+static string MakeFileHeader(const DiskResponseCache::BaseVersion &base_version) {
+    string header(FILE_MAGIC);
+    for (const uint64_t field : {base_version.hash, base_version.size,
+                                 static_cast<uint64_t>(base_version.modification_time_ns)}) {
+        header.append(reinterpret_cast<const char *>(&field), sizeof(field));
+    }
+    return header;
+}
+
+DiskResponseCache::DiskResponseCache(const string &file_name, const BaseVersion &base_version)
+    : file_name_(file_name) {
+    try {
+        OpenLocked(base_version);
+        ReadRecords();
+    } catch (...) {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        throw;
+    }
+    flock(fd_, LOCK_UN);
+}
+
+DiskResponseCache::~DiskResponseCache() {
+    close(fd_);
+}
+
+void DiskResponseCache::OpenLocked(const BaseVersion &base_version) {
+    const string header = MakeFileHeader(base_version);
+    // Another process may replace the file between opening and locking it, then the new one is opened
+    while (true) {
+        fd_ = open(file_name_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            throw MakeSystemError("can't open " + file_name_);
+        }
+        if (flock(fd_, LOCK_EX) != 0) {
+            throw MakeSystemError("can't lock " + file_name_);
+        }
+        struct stat file_stat{};
+        struct stat path_stat{};
+        if (fstat(fd_, &file_stat) != 0) {
+            throw MakeSystemError("can't stat " + file_name_);
+        }
+        if (stat(file_name_.c_str(), &path_stat) != 0 || path_stat.st_ino != file_stat.st_ino) {
+            close(fd_);
+            continue;
+        }
+
+        if (file_stat.st_size == 0) {
+            if (!WriteAll(fd_, header)) {
+                throw MakeSystemError("can't write " + file_name_);
+            }
+            return;
+        }
+        string file_header(header.size(), '\0');
+        if (pread(fd_, file_header.data(), file_header.size(), 0) == static_cast<ssize_t>(header.size())
+            && file_header == header) {
+            return;
+        }
+
+        // File of another base. It is replaced rather than truncated: processes still answering from that base
+        // keep reading their mapping of it
+        const string temp_file_name = file_name_ + ".tmp";
+        const int temp_fd = open(temp_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (temp_fd < 0) {
+            throw MakeSystemError("can't open " + temp_file_name);
+        }
+        const bool is_written = WriteAll(temp_fd, header);
+        close(temp_fd);
+        if (!is_written || rename(temp_file_name.c_str(), file_name_.c_str()) != 0) {
+            throw MakeSystemError("can't replace " + file_name_);
+        }
+        close(fd_);
+    }
+}
+
+void DiskResponseCache::ReadRecords() {
+    file_.emplace(fd_, file_name_);
+    const string_view data = file_->GetData();
+    size_t pos = MakeFileHeader({}).size();
+    while (data.size() - pos >= sizeof(RecordHeader)) {
+        RecordHeader record;
+        memcpy(&record, data.data() + pos, sizeof(record));
+        const size_t body_pos = pos + sizeof(record);
+        if (data.size() - body_pos < size_t{record.key_size} + record.text_size
+            || record.request_id_pos > record.text_size) {
+            break;
+        }
+        // The first record of a key wins, later ones come from processes that missed it at the same time
+        index_.emplace(
+            data.substr(body_pos, record.key_size),
+            Response{data.substr(body_pos + record.key_size, record.text_size), record.request_id_pos}
+        );
+        pos = body_pos + record.key_size + record.text_size;
+    }
+    // Left by a crash in the middle of appending, new records must not follow it
+    if (pos < data.size() && ftruncate(fd_, static_cast<off_t>(pos)) != 0) {
+        throw MakeSystemError("can't truncate " + file_name_);
+    }
+}
+
+optional<DiskResponseCache::Response> DiskResponseCache::Find(string_view key) const {
+    if (const auto it = index_.find(key); it != index_.end()) {
+        return it->second;
+    }
+    return nullopt;
+}
+
+void DiskResponseCache::Insert(const string &key, string_view text, size_t request_id_pos) {
+    static constexpr size_t MAX_SIZE = numeric_limits<uint32_t>::max();
+    if (index_.count(key) || key.size() > MAX_SIZE || text.size() > MAX_SIZE) {
+        return;
+    }
+    const RecordHeader header{
+        static_cast<uint32_t>(key.size()),
+        static_cast<uint32_t>(text.size()),
+        static_cast<uint32_t>(request_id_pos)
+    };
+    string record(reinterpret_cast<const char *>(&header), sizeof(header));
+    record.reserve(record.size() + key.size() + text.size());
+    record += key;
+    record += text;
+
+    lock_guard lock(append_mutex_);
+    if (is_append_failed_ || !appended_keys_.insert(key).second) {
+        return;
+    }
+    flock(fd_, LOCK_EX);
+    const bool is_written = WriteAll(fd_, record);
+    const int error = errno;
+    flock(fd_, LOCK_UN);
+    if (!is_written) {
+        is_append_failed_ = true;
+        cerr << "can't append to " << file_name_ << ": " << generic_category().message(error) << '\n';
+    }
+}
+
+}
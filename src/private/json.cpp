@@ -1,4 +1,9 @@
 #include "json.h"
+#include "json_scanner.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
 
 using namespace std;
 
@@ -26,33 +31,51 @@ Node LoadBool(istream &input) {
 }
 
 Node LoadNumber(istream &input) {
-    bool is_negative = false;
+    string text;
+    const auto take_digits = [&input, &text] {
+        while (isdigit(input.peek())) {
+            text.push_back(static_cast<char>(input.get()));
+        }
+    };
     if (input.peek() == '-') {
-        is_negative = true;
-        input.get();
+        text.push_back(static_cast<char>(input.get()));
     }
-    int int_part = 0;
-    while (isdigit(input.peek())) {
-        int_part *= 10;
-        int_part += input.get() - '0';
+    take_digits();
+    if (input.peek() == '.') {
+        text.push_back(static_cast<char>(input.get()));
+        take_digits();
     }
-    if (input.peek() != '.') {
-        return Node(int_part * (is_negative ? -1 : 1));
+    if (input.peek() == 'e' || input.peek() == 'E') {
+        text.push_back(static_cast<char>(input.get()));
+        if (input.peek() == '+' || input.peek() == '-') {
+            text.push_back(static_cast<char>(input.get()));
+        }
+        take_digits();
     }
-    input.get();  // '.'
-    double result = int_part;
-    double frac_mult = 0.1;
-    while (isdigit(input.peek())) {
-        result += frac_mult * (input.get() - '0');
-        frac_mult /= 10;
+    // Otherwise the caller would read the same character again and again
+    if (text.empty()) {
+        throw invalid_argument("unexpected character in JSON");
     }
-    return Node(result * (is_negative ? -1 : 1));
+    return visit([](auto value) { return Node(value); }, Scanner::ParseNumber(text));
 }
 
 Node LoadString(istream &input) {
-    string line;
-    getline(input, line, '"');
-    return Node(move(line));
+    string raw;
+    getline(input, raw, '"');
+    // A quote after an odd number of backslashes is escaped and belongs to the string
+    for (string part; input && (raw.size() - raw.find_last_not_of('\\') - 1) % 2 == 1;) {
+        getline(input, part, '"');
+        raw += '"';
+        raw += part;
+    }
+    // Same check as Scanner::ScanString, JSON allows control characters only escaped
+    if (any_of(raw.begin(), raw.end(), [](char c) { return static_cast<unsigned char>(c) < 0x20; })) {
+        throw invalid_argument("unescaped control character in JSON string");
+    }
+    if (raw.find('\\') == string::npos) {
+        return Node(move(raw));
+    }
+    return Node(Scanner::Unescape(raw));
 }
 
 Node LoadDict(istream &input) {
@@ -94,15 +117,94 @@ Document Load(istream &input) {
     return Document{LoadNode(input)};
 }
 
+// Parses contiguous buffer with pointer arithmetic instead of going through istream for every character.
+// Produces the same nodes as the istream parser
+class BufferParser {
+ public:
+    explicit BufferParser(string_view input) : scanner_(input) {}
+
+    Node ParseNode() {
+        const char c = scanner_.NextToken();
+        if (c == '[') {
+            return ParseArray();
+        } else if (c == '{') {
+            return ParseDict();
+        } else if (c == '"') {
+            return Node(scanner_.ScanUnescapedString());
+        } else if (c == 't' || c == 'f') {
+            scanner_.Unget();
+            return Node(scanner_.ScanBool());
+        } else if (c == '\0') {
+            throw invalid_argument("unexpected end of JSON");
+        } else {
+            scanner_.Unget();
+            return visit([](auto value) { return Node(value); }, scanner_.ScanNumber());
+        }
+    }
+
+ private:
+    Scanner scanner_;
+
+    Node ParseArray() {
+        Array result;
+        for (char c; (c = scanner_.NextToken()) && c != ']';) {
+            if (c != ',') {
+                scanner_.Unget();
+            }
+            result.push_back(ParseNode());
+        }
+        return Node(move(result));
+    }
+
+    Node ParseDict() {
+        Dict result;
+        for (char c; (c = scanner_.NextToken()) && c != '}';) {
+            if (c == ',') {
+                scanner_.NextToken();
+            }
+            string key = scanner_.ScanUnescapedString();
+            scanner_.NextToken();  // ':'
+            result.emplace(move(key), ParseNode());
+        }
+        return Node(move(result));
+    }
+};
+
+Document Load(string_view input) {
+    return Document{BufferParser(input).ParseNode()};
+}
+
+string_view GetEscapeSequence(char c) {
+    static const auto CONTROL_SEQUENCES = [] {
+        array<string, 0x20> sequences;
+        static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+        for (size_t code = 0; code < sequences.size(); ++code) {
+            sequences[code] = string("\\u00") + HEX_DIGITS[code >> 4] + HEX_DIGITS[code & 0xF];
+        }
+        sequences['\n'] = "\\n";
+        sequences['\r'] = "\\r";
+        sequences['\t'] = "\\t";
+        return sequences;
+    }();
+    if (c == '"') {
+        return "\\\"";
+    } else if (c == '\\') {
+        return "\\\\";
+    }
+    return CONTROL_SEQUENCES[static_cast<unsigned char>(c)];
+}
+
 template<>
 void PrintValue<string>(const string &value, ostream &output) {
     output << '"';
-    for (const char c : value) {
-        if (c == '"' || c == '\\') {
-            output << '\\';
+    size_t run_begin = 0;
+    for (size_t pos = 0; pos < value.size(); ++pos) {
+        if (NeedsEscaping(value[pos])) {
+            output.write(value.data() + run_begin, pos - run_begin) << GetEscapeSequence(value[pos]);
+            run_begin = pos + 1;
         }
-        output << c;
     }
+    output.write(value.data() + run_begin, value.size() - run_begin);
     output << '"';
 }
 
@@ -0,0 +1,243 @@
+#include "json_view.h"
+#include "json_scanner.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Json::View {
+
+Arena::Arena(size_t first_block_size) : next_block_size_(first_block_size) {}
+
+void Arena::AddBlock(size_t min_size) {
+    const size_t block_size = max(next_block_size_, min_size);
+    // Not make_unique, it would zero the block, and the first one is as big as the whole input
+    blocks_.push_back(unique_ptr<char[]>(new char[block_size]));
+    pos_ = blocks_.back().get();
+    left_ = block_size;
+    next_block_size_ = block_size * 2;
+}
+
+const Node *Dict::Find(string_view key) const {
+    const auto it = find_if(begin(), end(), [key](const Member &member) { return member.key == key; });
+    return it != end() ? &it->value : nullptr;
+}
+
+const Node &Dict::at(string_view key) const {
+    if (const Node *node = Find(key)) {
+        return *node;
+    }
+    throw out_of_range("no key " + string(key) + " in JSON object");
+}
+
+Json::Node Node::ToNode() const {
+    switch (type_) {
+        case Type::Array: {
+            Json::Array array;
+            array.reserve(size_);
+            for (const Node &item : AsArray()) {
+                array.push_back(item.ToNode());
+            }
+            return Json::Node(move(array));
+        }
+        case Type::Dict: {
+            Json::Dict dict;
+            for (const auto&[key, value] : AsMap()) {
+                dict.emplace(string(key), value.ToNode());
+            }
+            return Json::Node(move(dict));
+        }
+        case Type::Bool:
+            return Json::Node(bool_);
+        case Type::Int:
+            return Json::Node(int_);
+        case Type::Double:
+            return Json::Node(double_);
+        case Type::String:
+            return Json::Node(string(AsString()));
+    }
+    return {};
+}
+
+// Children of the array or object being parsed are collected on a reusable stack
+// and moved into the arena as one contiguous block once it is closed
+class Parser {
+ public:
+    Parser(Scanner &scanner, Arena &arena) : scanner_(scanner), arena_(arena) {}
+
+    Node ParseNode() {
+        const char c = scanner_.NextToken();
+        if (c == '[') {
+            return ParseArray();
+        } else if (c == '{') {
+            return ParseDict();
+        } else if (c == '"') {
+            return MakeString(ParseString());
+        } else if (c == 't' || c == 'f') {
+            scanner_.Unget();
+            Node node;
+            node.type_ = Node::Type::Bool;
+            node.bool_ = scanner_.ScanBool();
+            return node;
+        } else if (c == '\0') {
+            throw invalid_argument("unexpected end of JSON");
+        } else {
+            scanner_.Unget();
+            return visit([](auto value) { return MakeNumber(value); }, scanner_.ScanNumber());
+        }
+    }
+
+ private:
+    Scanner &scanner_;
+    Arena &arena_;
+    vector<Node> items_stack_;
+    vector<Member> members_stack_;
+
+    static Node MakeNumber(int64_t value) {
+        Node node;
+        node.type_ = Node::Type::Int;
+        node.int_ = value;
+        return node;
+    }
+
+    static Node MakeNumber(double value) {
+        Node node;
+        node.type_ = Node::Type::Double;
+        node.double_ = value;
+        return node;
+    }
+
+    static Node MakeString(string_view value) {
+        Node node;
+        node.type_ = Node::Type::String;
+        node.size_ = static_cast<uint32_t>(value.size());
+        node.chars_ = value.data();
+        return node;
+    }
+
+    string_view ParseString() {
+        const auto[raw, has_escapes] = scanner_.ScanString();
+        if (!has_escapes) {
+            return raw;
+        }
+        char *chars = arena_.Allocate<char>(raw.size());
+        return {chars, Scanner::Unescape(raw, chars)};
+    }
+
+    template<typename T>
+    const T *MoveToArena(vector<T> &stack, size_t stack_begin) {
+        const size_t count = stack.size() - stack_begin;
+        T *items = arena_.Allocate<T>(count);
+        uninitialized_copy(begin(stack) + stack_begin, end(stack), items);
+        stack.resize(stack_begin);
+        return items;
+    }
+
+    Node ParseArray() {
+        const size_t stack_begin = items_stack_.size();
+        for (char c; (c = scanner_.NextToken()) && c != ']';) {
+            if (c != ',') {
+                scanner_.Unget();
+            }
+            Node item = ParseNode();
+            items_stack_.push_back(item);
+        }
+        Node node;
+        node.type_ = Node::Type::Array;
+        node.size_ = static_cast<uint32_t>(items_stack_.size() - stack_begin);
+        node.items_ = MoveToArena(items_stack_, stack_begin);
+        return node;
+    }
+
+    Node ParseDict() {
+        const size_t stack_begin = members_stack_.size();
+        for (char c; (c = scanner_.NextToken()) && c != '}';) {
+            if (c == ',') {
+                scanner_.NextToken();
+            }
+            const string_view key = ParseString();
+            scanner_.NextToken();  // ':'
+            Node value = ParseNode();
+            members_stack_.push_back({key, value});
+        }
+        Node node;
+        node.type_ = Node::Type::Dict;
+        node.size_ = static_cast<uint32_t>(members_stack_.size() - stack_begin);
+        node.members_ = MoveToArena(members_stack_, stack_begin);
+        return node;
+    }
+};
+
+Document Load(string_view input) {
+    // Nodes of typical documents take less space than their text, so one block of the input size is enough
+    Arena arena(max<size_t>(input.size(), 1 << 12));
+    Scanner scanner(input);
+    Node root = Parser(scanner, arena).ParseNode();
+    return Document(move(arena), root);
+}
+
+vector<string_view> SplitArray(string_view input) {
+    vector<string_view> items;
+    Reader reader(input);
+    if (reader.EnterArray()) {
+        while (reader.NextItem()) {
+            items.push_back(reader.SkipValue());
+        }
+    }
+    return items;
+}
+
+bool Reader::EnterObject() {
+    if (scanner_.PeekToken() != '{') {
+        return false;
+    }
+    scanner_.NextToken();
+    return true;
+}
+
+bool Reader::EnterArray() {
+    if (scanner_.PeekToken() != '[') {
+        return false;
+    }
+    scanner_.NextToken();
+    return true;
+}
+
+optional<string> Reader::NextKey() {
+    char c = scanner_.NextToken();
+    if (c == ',') {
+        c = scanner_.NextToken();
+    }
+    if (c != '"') {
+        return nullopt;
+    }
+    string key = scanner_.ScanUnescapedString();
+    scanner_.NextToken();  // ':'
+    return key;
+}
+
+bool Reader::NextItem() {
+    const char c = scanner_.NextToken();
+    if (!c || c == ']') {
+        return false;
+    }
+    if (c != ',') {
+        scanner_.Unget();
+    }
+    return true;
+}
+
+Document Reader::ReadValue() {
+    // Values read one at a time are small, unlike whole documents
+    Arena arena(1 << 12);
+    Node root = Parser(scanner_, arena).ParseNode();
+    return Document(move(arena), root);
+}
+
+string_view Reader::SkipValue() {
+    return scanner_.SkipValue();
+}
+
+}
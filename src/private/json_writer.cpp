@@ -0,0 +1,221 @@
+#include "json_writer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <system_error>
+
+using namespace std;
+
+namespace Json {
+
+Writer::Writer(ostream &output, DoubleFormat double_format, int precision)
+    : output_(output), double_format_(double_format), precision_(precision) {
+    buffer_.reserve(FLUSH_THRESHOLD * 2);
+}
+
+Writer::~Writer() {
+    Flush();
+}
+
+void Writer::BeginObject() {
+    BeginScope('{', false);
+}
+
+void Writer::Key(string_view key) {
+    const uint64_t level_bit = uint64_t(1) << (depth_ - 1);
+    if (has_items_ & level_bit) {
+        buffer_ += ", ";
+    }
+    has_items_ |= level_bit;
+    buffer_ += '"';
+    AppendEscaped(key);
+    buffer_ += "\": ";
+}
+
+void Writer::EndObject() {
+    EndScope('}');
+}
+
+void Writer::BeginArray() {
+    BeginScope('[', true);
+}
+
+void Writer::EndArray() {
+    EndScope(']');
+}
+
+void Writer::Write(const Node &node) {
+    visit([this](const auto &value) { Write(value); }, node.GetBase());
+}
+
+void Writer::Write(const Array &nodes) {
+    BeginArray();
+    for (const Node &node : nodes) {
+        Write(node);
+    }
+    EndArray();
+}
+
+void Writer::Write(const Dict &dict) {
+    BeginObject();
+    for (const auto&[key, node] : dict) {
+        Key(key);
+        Write(node);
+    }
+    EndObject();
+}
+
+void Writer::Write(string_view value) {
+    BeginValue();
+    buffer_ += '"';
+    AppendEscaped(value);
+    buffer_ += '"';
+    FlushIfFull();
+}
+
+void Writer::Write(bool value) {
+    BeginValue();
+    WriteRaw(value ? "true" : "false");
+}
+
+void Writer::Write(int value) {
+    char chars[16];
+    const auto result = to_chars(begin(chars), end(chars), value);
+    BeginValue();
+    WriteRaw(string_view(chars, result.ptr - chars));
+}
+
+void Writer::Write(int64_t value) {
+    char chars[24];
+    const auto result = to_chars(begin(chars), end(chars), value);
+    BeginValue();
+    WriteRaw(string_view(chars, result.ptr - chars));
+}
+
+void Writer::Write(double value) {
+    // Enough for all but fixed format of big values or big precisions
+    char chars[512];
+    const auto result = FormatDouble(value, begin(chars), end(chars));
+    BeginValue();
+    if (result.ec == errc{}) {
+        WriteRaw(string_view(chars, result.ptr - chars));
+        return;
+    }
+    // Up to 309 integer digits, the sign, the point and precision digits, or fewer in the other formats
+    string long_chars(max(precision_, 0) + 320, '\0');
+    const auto long_result = FormatDouble(value, long_chars.data(), long_chars.data() + long_chars.size());
+    assert(long_result.ec == errc{});
+    WriteRaw(string_view(long_chars.data(), long_result.ptr - long_chars.data()));
+}
+
+to_chars_result Writer::FormatDouble(double value, char *first, char *last) const {
+    switch (double_format_) {
+        case DoubleFormat::Compatible:
+            return to_chars(first, last, value, chars_format::general, precision_);
+        case DoubleFormat::Shortest:
+            return to_chars(first, last, value);
+        case DoubleFormat::Fixed:
+            return to_chars(first, last, value, chars_format::fixed, precision_);
+    }
+    return {first, errc::invalid_argument};
+}
+
+void Writer::WriteRaw(string_view text) {
+    buffer_.append(text);
+    FlushIfFull();
+}
+
+void Writer::WriteSerialized(string_view value) {
+    BeginValue();
+    WriteRaw(value);
+}
+
+void Writer::WriteRaw(char c) {
+    buffer_ += c;
+    FlushIfFull();
+}
+
+void Writer::Flush() {
+    output_.write(buffer_.data(), buffer_.size());
+    flushed_size_ += buffer_.size();
+    buffer_.clear();
+}
+
+void Writer::BeginValue() {
+    if (depth_ == 0) {
+        return;
+    }
+    const uint64_t level_bit = uint64_t(1) << (depth_ - 1);
+    if (in_array_ & level_bit) {
+        if (has_items_ & level_bit) {
+            buffer_ += ", ";
+        }
+        has_items_ |= level_bit;
+    }
+}
+
+void Writer::BeginScope(char bracket, bool is_array) {
+    assert(depth_ < MAX_DEPTH);
+    BeginValue();
+    buffer_ += bracket;
+    const uint64_t level_bit = uint64_t(1) << depth_++;
+    in_array_ = is_array ? in_array_ | level_bit : in_array_ & ~level_bit;
+    has_items_ &= ~level_bit;
+}
+
+void Writer::EndScope(char bracket) {
+    assert(depth_ > 0);
+    --depth_;
+    buffer_ += bracket;
+    FlushIfFull();
+}
+
+void Writer::AppendEscaped(string_view value) {
+    // Everything between the characters to escape is copied as one run
+    const char *pos = value.data();
+    const char *end = value.data() + value.size();
+    while (pos < end) {
+        const char *run_end = pos;
+        while (run_end < end && !NeedsEscaping(*run_end)) {
+            ++run_end;
+        }
+        buffer_.append(pos, run_end);
+        if (run_end < end) {
+            buffer_ += GetEscapeSequence(*run_end++);
+        }
+        pos = run_end;
+        FlushIfFull();
+    }
+}
+
+Writer::EscapingBuffer::EscapingBuffer(Writer &writer) : writer_(writer) {
+    setp(begin(chars_), end(chars_));
+}
+
+Writer::EscapingBuffer::int_type Writer::EscapingBuffer::overflow(int_type c) {
+    Drain();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int Writer::EscapingBuffer::sync() {
+    Drain();
+    return 0;
+}
+
+void Writer::EscapingBuffer::Drain() {
+    writer_.AppendEscaped({pbase(), static_cast<size_t>(pptr() - pbase())});
+    setp(begin(chars_), end(chars_));
+}
+
+void Writer::FlushIfFull() {
+    if (buffer_.size() >= FLUSH_THRESHOLD) {
+        Flush();
+    }
+}
+
+}
@@ -53,9 +53,9 @@ RenderSettings ParseRenderSettings(const Json::Dict &json) {
     result.underlayer_width = json.at("underlayer_width").AsDouble();
     result.stop_radius = json.at("stop_radius").AsDouble();
     result.bus_label_offset = ParsePoint(json.at("bus_label_offset"));
-    result.bus_label_font_size = json.at("bus_label_font_size").AsInt();
+    result.bus_label_font_size = static_cast<int>(json.at("bus_label_font_size").AsInt());
     result.stop_label_offset = ParsePoint(json.at("stop_label_offset"));
-    result.stop_label_font_size = json.at("stop_label_font_size").AsInt();
+    result.stop_label_font_size = static_cast<int>(json.at("stop_label_font_size").AsInt());
 
     const auto &layers_array = json.at("layers").AsArray();
     result.layers.reserve(layers_array.size());
@@ -66,14 +66,6 @@ RenderSettings ParseRenderSettings(const Json::Dict &json) {
     return result;
 }
 
-static map<string, Descriptions::Bus> CopyBusesDict(const Descriptions::BusesDict &source) {
-    map<string, Descriptions::Bus> target;
-    for (const auto&[name, data_ptr] : source) {
-        target.emplace(name, *data_ptr);
-    }
-    return target;
-}
-
 static unordered_set<string> FindSupportStops(const Descriptions::BusesDict &buses_dict) {
     unordered_set<string> support_stops;
     unordered_map<string, const Descriptions::Bus *> stops_first_bus;
@@ -278,9 +270,10 @@ class CoordsCompressor {
     }
 };
 
-static map<string, Svg::Point> ComputeStopsCoordsByGrid(const Descriptions::StopsDict &stops_dict,
-                                                        const Descriptions::BusesDict &buses_dict,
-                                                        const RenderSettings &render_settings) {
+static vector<Svg::Point> ComputeStopsCoordsByGrid(const Descriptions::StopsDict &stops_dict,
+                                                   const Descriptions::BusesDict &buses_dict,
+                                                   const NameIndex &stops,
+                                                   const RenderSettings &render_settings) {
     const auto stops_coords = ComputeInterpolatedStopsGeoCoords(stops_dict, buses_dict);
 
     const auto[neighbour_lats, neighbour_lons] = BuildCoordNeighboursDicts(stops_coords, buses_dict);
@@ -289,32 +282,51 @@ static map<string, Svg::Point> ComputeStopsCoordsByGrid(const Descriptions::Stop
     compressor.FillIndices(neighbour_lats, neighbour_lons);
     compressor.FillTargets(render_settings.max_width, render_settings.max_height, render_settings.padding);
 
-    map<string, Svg::Point> new_stops_coords;
+    vector<Svg::Point> new_stops_coords(stops.GetCount());
     for (const auto&[stop_name, coord] : stops_coords) {
-        new_stops_coords[stop_name] = {compressor.MapLon(coord.longitude), compressor.MapLat(coord.latitude)};
+        new_stops_coords[stops.At(stop_name)] = {compressor.MapLon(coord.longitude), compressor.MapLat(coord.latitude)};
     }
 
     return new_stops_coords;
 }
 
-static unordered_map<string, Svg::Color> ChooseBusColors(const Descriptions::BusesDict &buses_dict,
-                                                         const RenderSettings &render_settings) {
+static vector<Svg::Color> ChooseBusColors(const Descriptions::BusesDict &buses_dict,
+                                          const NameIndex &buses,
+                                          const RenderSettings &render_settings) {
     const auto &palette = render_settings.palette;
-    unordered_map<string, Svg::Color> bus_colors;
+    vector<Svg::Color> bus_colors(buses.GetCount());
     int idx = 0;
     for (const auto&[bus_name, bus_ptr] : buses_dict) {
-        bus_colors[bus_name] = palette[idx++ % palette.size()];
+        bus_colors[buses.At(bus_name)] = palette[idx++ % palette.size()];
     }
     return bus_colors;
 }
 
+template<typename Names>
+static vector<StopId> FindStopIds(const Names &names, const NameIndex &stops) {
+    vector<StopId> stop_ids;
+    stop_ids.reserve(names.size());
+    for (const auto &name : names) {
+        stop_ids.push_back(stops.At(name));
+    }
+    return stop_ids;
+}
+
 MapRenderer::MapRenderer(const Descriptions::StopsDict &stops_dict,
                          const Descriptions::BusesDict &buses_dict,
+                         shared_ptr<const NameIndex> stops,
+                         shared_ptr<const NameIndex> buses,
                          const Json::Dict &render_settings_json)
     : render_settings_(ParseRenderSettings(render_settings_json)),
-      stops_coords_(ComputeStopsCoordsByGrid(stops_dict, buses_dict, render_settings_)),
-      bus_colors_(ChooseBusColors(buses_dict, render_settings_)),
-      buses_dict_(CopyBusesDict(buses_dict)) {
+      stops_(move(stops)),
+      buses_(move(buses)),
+      stops_coords_(ComputeStopsCoordsByGrid(stops_dict, buses_dict, *stops_, render_settings_)),
+      bus_colors_(ChooseBusColors(buses_dict, *buses_, render_settings_)),
+      bus_routes_(buses_->GetCount()) {
+    for (const auto&[bus_name, bus_ptr] : buses_dict) {
+        bus_routes_[buses_->At(bus_name)] = {FindStopIds(bus_ptr->stops, *stops_),
+                                             FindStopIds(bus_ptr->endpoints, *stops_)};
+    }
 }
 
 void RenderSettings::Serialize(TCProto::RenderSettings &proto) const {
@@ -373,39 +385,58 @@ RenderSettings RenderSettings::Deserialize(const TCProto::RenderSettings &proto)
 void MapRenderer::Serialize(TCProto::MapRenderer &proto) {
     render_settings_.Serialize(*proto.mutable_render_settings());
 
-    for (const auto&[name, point] : stops_coords_) {
+    for (StopId stop_id = 0; stop_id < stops_coords_.size(); ++stop_id) {
         auto &stop_coords_proto = *proto.add_stops_coords();
-        stop_coords_proto.set_name(name);
-        Svg::SerializePoint(point, *stop_coords_proto.mutable_point());
+        stop_coords_proto.set_name(stops_->GetName(stop_id));
+        Svg::SerializePoint(stops_coords_[stop_id], *stop_coords_proto.mutable_point());
     }
 
-    for (const auto&[name, color] : bus_colors_) {
+    for (BusId bus_id = 0; bus_id < bus_colors_.size(); ++bus_id) {
         auto &bus_color_proto = *proto.add_bus_colors();
-        bus_color_proto.set_name(name);
-        Svg::SerializeColor(color, *bus_color_proto.mutable_color());
+        bus_color_proto.set_name(buses_->GetName(bus_id));
+        Svg::SerializeColor(bus_colors_[bus_id], *bus_color_proto.mutable_color());
     }
 
-    for (const auto&[_, bus] : buses_dict_) {
-        bus.Serialize(*proto.add_bus_descriptions());
+    for (BusId bus_id = 0; bus_id < bus_routes_.size(); ++bus_id) {
+        auto &bus_proto = *proto.add_bus_descriptions();
+        bus_proto.set_name(buses_->GetName(bus_id));
+        for (const StopId stop_id : bus_routes_[bus_id].stops) {
+            bus_proto.add_stops(stops_->GetName(stop_id));
+        }
+        for (const StopId stop_id : bus_routes_[bus_id].endpoints) {
+            bus_proto.add_endpoints(stops_->GetName(stop_id));
+        }
     }
 }
 
-std::unique_ptr<MapRenderer> MapRenderer::Deserialize(const TCProto::MapRenderer &proto) {
+std::unique_ptr<MapRenderer> MapRenderer::Deserialize(const TCProto::MapRenderer &proto,
+                                                      shared_ptr<const NameIndex> stops,
+                                                      shared_ptr<const NameIndex> buses) {
     std::unique_ptr<MapRenderer> renderer_holder(new MapRenderer);
     auto &renderer = *renderer_holder;
 
     renderer.render_settings_ = RenderSettings::Deserialize(proto.render_settings());
+    renderer.stops_ = move(stops);
+    renderer.buses_ = move(buses);
 
+    renderer.stops_coords_.resize(renderer.stops_->GetCount());
     for (const auto &stop_coords_proto : proto.stops_coords()) {
-        renderer.stops_coords_.emplace(stop_coords_proto.name(), Svg::DeserializePoint(stop_coords_proto.point()));
+        renderer.stops_coords_[renderer.stops_->At(stop_coords_proto.name())] =
+            Svg::DeserializePoint(stop_coords_proto.point());
     }
 
+    renderer.bus_colors_.resize(renderer.buses_->GetCount());
     for (const auto &bus_color_proto : proto.bus_colors()) {
-        renderer.bus_colors_.emplace(bus_color_proto.name(), Svg::DeserializeColor(bus_color_proto.color()));
+        renderer.bus_colors_[renderer.buses_->At(bus_color_proto.name())] =
+            Svg::DeserializeColor(bus_color_proto.color());
     }
 
+    renderer.bus_routes_.resize(renderer.buses_->GetCount());
     for (const auto &bus_proto : proto.bus_descriptions()) {
-        renderer.buses_dict_.emplace(bus_proto.name(), Descriptions::Bus::Deserialize(bus_proto));
+        renderer.bus_routes_[renderer.buses_->At(bus_proto.name())] = {
+            FindStopIds(bus_proto.stops(), *renderer.stops_),
+            FindStopIds(bus_proto.endpoints(), *renderer.stops_),
+        };
     }
 
     return renderer_holder;
@@ -415,17 +446,17 @@ using RouteBusItem = TransportRouter::RouteInfo::BusItem;
 using RouteWaitItem = TransportRouter::RouteInfo::WaitItem;
 
 void MapRenderer::RenderBusLines(Svg::Document &svg) const {
-    for (const auto&[bus_name, bus] : buses_dict_) {
-        const auto &stops = bus.stops;
+    for (BusId bus_id = 0; bus_id < bus_routes_.size(); ++bus_id) {
+        const auto &stops = bus_routes_[bus_id].stops;
         if (stops.empty()) {
             continue;
         }
         Svg::Polyline line;
-        line.SetStrokeColor(bus_colors_.at(bus_name))
+        line.SetStrokeColor(bus_colors_[bus_id])
             .SetStrokeWidth(render_settings_.line_width)
             .SetStrokeLineCap("round").SetStrokeLineJoin("round");
-        for (const auto &stop_name : stops) {
-            line.AddPoint(stops_coords_.at(stop_name));
+        for (const StopId stop_id : stops) {
+            line.AddPoint(stops_coords_[stop_id]);
         }
         svg.Add(line);
     }
@@ -437,26 +468,24 @@ void MapRenderer::RenderRouteBusLines(Svg::Document &svg, const TransportRouter:
             continue;
         }
         const auto &bus_item = get<RouteBusItem>(item);
-        const string &bus_name = bus_item.bus_name;
-        const auto &stops = buses_dict_.at(bus_name).stops;
+        const auto &stops = bus_routes_[bus_item.bus_id].stops;
         if (stops.empty()) {
             continue;
         }
         Svg::Polyline line;
-        line.SetStrokeColor(bus_colors_.at(bus_name))
+        line.SetStrokeColor(bus_colors_[bus_item.bus_id])
             .SetStrokeWidth(render_settings_.line_width)
             .SetStrokeLineCap("round").SetStrokeLineJoin("round");
         for (size_t stop_idx = bus_item.start_stop_idx; stop_idx <= bus_item.finish_stop_idx; ++stop_idx) {
-            const string &stop_name = stops[stop_idx];
-            line.AddPoint(stops_coords_.at(stop_name));
+            line.AddPoint(stops_coords_[stops[stop_idx]]);
         }
         svg.Add(line);
     }
 }
 
-void MapRenderer::RenderBusLabel(Svg::Document &svg, const string &bus_name, const string &stop_name) const {
-    const auto &color = bus_colors_.at(bus_name);  // can be optimized a bit by moving upper
-    const auto point = stops_coords_.at(stop_name);
+void MapRenderer::RenderBusLabel(Svg::Document &svg, BusId bus_id, StopId stop_id) const {
+    const auto &color = bus_colors_[bus_id];
+    const auto point = stops_coords_[stop_id];
     const auto base_text =
         Svg::Text{}
             .SetPoint(point)
@@ -464,7 +493,7 @@ void MapRenderer::RenderBusLabel(Svg::Document &svg, const string &bus_name, con
             .SetFontSize(render_settings_.bus_label_font_size)
             .SetFontFamily("Verdana")
             .SetFontWeight("bold")
-            .SetData(bus_name);
+            .SetData(buses_->GetName(bus_id));
     svg.Add(
         Svg::Text(base_text)
             .SetFillColor(render_settings_.underlayer_color)
@@ -479,11 +508,11 @@ void MapRenderer::RenderBusLabel(Svg::Document &svg, const string &bus_name, con
 }
 
 void MapRenderer::RenderBusLabels(Svg::Document &svg) const {
-    for (const auto&[bus_name, bus] : buses_dict_) {
-        const auto &stops = bus.stops;
-        if (!stops.empty()) {
-            for (const string &endpoint : bus.endpoints) {
-                RenderBusLabel(svg, bus_name, endpoint);
+    for (BusId bus_id = 0; bus_id < bus_routes_.size(); ++bus_id) {
+        const auto &bus = bus_routes_[bus_id];
+        if (!bus.stops.empty()) {
+            for (const StopId endpoint : bus.endpoints) {
+                RenderBusLabel(svg, bus_id, endpoint);
             }
         }
     }
@@ -496,19 +525,18 @@ void MapRenderer::RenderRouteBusLabels(Svg::Document &svg, const TransportRouter
             continue;
         }
         const auto &bus_item = get<RouteBusItem>(item);
-        const string &bus_name = bus_item.bus_name;
-        const auto &bus = buses_dict_.at(bus_name);
+        const auto &bus = bus_routes_[bus_item.bus_id];
         const auto &stops = bus.stops;
         if (stops.empty()) {
             continue;
         }
         for (const size_t stop_idx : {bus_item.start_stop_idx, bus_item.finish_stop_idx}) {
-            const auto stop_name = stops[stop_idx];
+            const StopId stop_id = stops[stop_idx];
             if (stop_idx == 0
                 || stop_idx == stops.size() - 1
-                || find(begin(bus.endpoints), end(bus.endpoints), stop_name) != end(bus.endpoints)
+                || find(begin(bus.endpoints), end(bus.endpoints), stop_id) != end(bus.endpoints)
                 ) {
-                RenderBusLabel(svg, bus_name, stop_name);
+                RenderBusLabel(svg, bus_item.bus_id, stop_id);
             }
         }
     }
@@ -522,7 +550,7 @@ void MapRenderer::RenderStopPoint(Svg::Document &svg, Svg::Point point) const {
 }
 
 void MapRenderer::RenderStopPoints(Svg::Document &svg) const {
-    for (const auto&[_, stop_point] : stops_coords_) {
+    for (const Svg::Point stop_point : stops_coords_) {
         RenderStopPoint(svg, stop_point);
     }
 }
@@ -534,26 +562,24 @@ void MapRenderer::RenderRouteStopPoints(Svg::Document &svg, const TransportRoute
             continue;
         }
         const auto &bus_item = get<RouteBusItem>(item);
-        const string &bus_name = bus_item.bus_name;
-        const auto &stops = buses_dict_.at(bus_name).stops;
+        const auto &stops = bus_routes_[bus_item.bus_id].stops;
         if (stops.empty()) {
             continue;
         }
         for (size_t stop_idx = bus_item.start_stop_idx; stop_idx <= bus_item.finish_stop_idx; ++stop_idx) {
-            const string &stop_name = stops[stop_idx];
-            RenderStopPoint(svg, stops_coords_.at(stop_name));
+            RenderStopPoint(svg, stops_coords_[stops[stop_idx]]);
         }
     }
 }
 
-void MapRenderer::RenderStopLabel(Svg::Document &svg, Svg::Point point, const string &name) const {
+void MapRenderer::RenderStopLabel(Svg::Document &svg, StopId stop_id) const {
     auto base_text =
         Svg::Text{}
-            .SetPoint(point)
+            .SetPoint(stops_coords_[stop_id])
             .SetOffset(render_settings_.stop_label_offset)
             .SetFontSize(render_settings_.stop_label_font_size)
             .SetFontFamily("Verdana")
-            .SetData(name);
+            .SetData(stops_->GetName(stop_id));
     svg.Add(
         Svg::Text(base_text)
             .SetFillColor(render_settings_.underlayer_color)
@@ -568,8 +594,8 @@ void MapRenderer::RenderStopLabel(Svg::Document &svg, Svg::Point point, const st
 }
 
 void MapRenderer::RenderStopLabels(Svg::Document &svg) const {
-    for (const auto&[stop_name, stop_point] : stops_coords_) {
-        RenderStopLabel(svg, stop_point, stop_name);
+    for (StopId stop_id = 0; stop_id < stops_coords_.size(); ++stop_id) {
+        RenderStopLabel(svg, stop_id);
     }
 }
 
@@ -581,15 +607,12 @@ void MapRenderer::RenderRouteStopLabels(Svg::Document &svg, const TransportRoute
         if (!holds_alternative<RouteWaitItem>(item)) {
             continue;
         }
-        const auto &wait_item = get<RouteWaitItem>(item);
-        const string &stop_name = wait_item.stop_name;
-        RenderStopLabel(svg, stops_coords_.at(stop_name), stop_name);
+        RenderStopLabel(svg, get<RouteWaitItem>(item).stop_id);
     }
 
     // draw stop label for last stop
     const auto &last_bus_item = get<RouteBusItem>(route.items.back());
-    const string &last_stop_name = buses_dict_.at(last_bus_item.bus_name).stops[last_bus_item.finish_stop_idx];
-    RenderStopLabel(svg, stops_coords_.at(last_stop_name), last_stop_name);
+    RenderStopLabel(svg, bus_routes_[last_bus_item.bus_id].stops[last_bus_item.finish_stop_idx]);
 }
 
 const unordered_map<
@@ -613,12 +636,12 @@ const unordered_map<
 };
 
 const Svg::Document &MapRenderer::Render() const {
-    if (!whole_map_) {
+    call_once(whole_map_once_, [this] {
         whole_map_ = Svg::Document{};
         for (const auto &layer : render_settings_.layers) {
             (this->*MAP_LAYER_ACTIONS.at(layer))(*whole_map_);
         }
-    }
+    });
     return *whole_map_;
 }
 
@@ -0,0 +1,83 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+using namespace std;
+
+static system_error MakeSystemError(const string &what) {
+    return system_error(errno, generic_category(), what);
+}
+
+MappedFile::MappedFile(const string &file_name) {
+    const int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw MakeSystemError("can't open " + file_name);
+    }
+    try {
+        Map(fd, file_name);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);  // mapping stays valid after closing the descriptor
+}
+
+MappedFile::MappedFile(int fd, const string &file_name) {
+    Map(fd, file_name);
+}
+
+void MappedFile::Map(int fd, const string &file_name) {
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0) {
+        throw MakeSystemError("can't stat " + file_name);
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    modification_time_ns_ = static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1'000'000'000 + file_stat.st_mtim.tv_nsec;
+
+    // Empty mapping is not allowed, empty file is represented by empty view
+    if (size_ > 0) {
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data_ == MAP_FAILED) {
+            data_ = nullptr;
+            throw MakeSystemError("can't map " + file_name);
+        }
+        // Both are only hints, so failures are ignored
+        madvise(data_, size_, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(data_, size_, MADV_HUGEPAGE);
+#endif
+    }
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : data_(exchange(other.data_, nullptr)),
+      size_(exchange(other.size_, 0)),
+      modification_time_ns_(exchange(other.modification_time_ns_, 0)) {
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        MappedFile moved(move(other));
+        swap(data_, moved.data_);
+        swap(size_, moved.size_);
+        swap(modification_time_ns_, moved.modification_time_ns_);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+}
+
+string_view MappedFile::GetData() const {
+    return {static_cast<const char *>(data_), size_};
+}
@@ -0,0 +1,29 @@
+#include "name_index.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+NameIndex::NameIndex(vector<string> names) : names_(move(names)) {
+    sort(names_.begin(), names_.end());
+    names_.erase(unique(names_.begin(), names_.end()), names_.end());
+    ids_.reserve(names_.size());
+    for (uint32_t id = 0; id < names_.size(); ++id) {
+        ids_.emplace(names_[id], id);
+    }
+}
+
+optional<uint32_t> NameIndex::Find(string_view name) const {
+    if (const auto it = ids_.find(name); it != ids_.end()) {
+        return it->second;
+    }
+    return nullopt;
+}
+
+uint32_t NameIndex::At(string_view name) const {
+    if (const auto it = ids_.find(name); it != ids_.end()) {
+        return it->second;
+    }
+    throw out_of_range("unknown name " + string(name));
+}
@@ -0,0 +1,70 @@
+#include "proto_sections.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <stdexcept>
+
+using namespace std;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::io::StringOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+namespace ProtoSections {
+
+vector<Field> Split(string_view message) {
+    CodedInputStream input(reinterpret_cast<const uint8_t *>(message.data()), static_cast<int>(message.size()));
+    vector<Field> fields;
+    int field_begin = input.CurrentPosition();
+    while (const uint32_t tag = input.ReadTag()) {
+        Field field{.number = WireFormatLite::GetTagFieldNumber(tag), .bytes = {}, .payload = {}};
+        if (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+            uint32_t length;
+            if (!input.ReadVarint32(&length) || length > message.size() - input.CurrentPosition()) {
+                throw runtime_error("malformed base section");
+            }
+            field.payload = message.substr(input.CurrentPosition(), length);
+            input.Skip(static_cast<int>(length));
+        } else if (!WireFormatLite::SkipField(&input, tag)) {
+            throw runtime_error("malformed base section");
+        }
+        field.bytes = message.substr(field_begin, input.CurrentPosition() - field_begin);
+        fields.push_back(field);
+        field_begin = input.CurrentPosition();
+    }
+    // ReadTag returns 0 both at the end and on a malformed tag
+    if (static_cast<size_t>(input.CurrentPosition()) != message.size()) {
+        throw runtime_error("malformed base section");
+    }
+    return fields;
+}
+
+vector<string_view> CollectPayloads(const vector<Field> &fields, int number) {
+    vector<string_view> payloads;
+    for (const Field &field : fields) {
+        if (field.number == number) {
+            payloads.push_back(field.payload);
+        }
+    }
+    return payloads;
+}
+
+void AppendField(string &message, int number, string_view payload) {
+    StringOutputStream stream(&message);
+    CodedOutputStream output(&stream);
+    output.WriteTag(WireFormatLite::MakeTag(number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+    output.WriteVarint32(static_cast<uint32_t>(payload.size()));
+    output.WriteRaw(payload.data(), static_cast<int>(payload.size()));
+}
+
+void AppendField(string &message, int number, const google::protobuf::MessageLite &payload) {
+    StringOutputStream stream(&message);
+    CodedOutputStream output(&stream);
+    output.WriteTag(WireFormatLite::MakeTag(number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+    output.WriteVarint32(static_cast<uint32_t>(payload.ByteSizeLong()));
+    payload.SerializeWithCachedSizes(&output);
+}
+
+}
@@ -0,0 +1,158 @@
+#include "request_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+namespace Requests::Metrics {
+
+static constexpr uint64_t SUB_BUCKET_COUNT = uint64_t(1) << Histogram::SUB_BUCKET_BITS;
+static constexpr uint64_t MAX_BUCKET_VALUE = (uint64_t(1) << Histogram::MAX_VALUE_BITS) - 1;
+
+// Bucket of value v >= SUB_BUCKET_COUNT is given by the position of its highest bit and the SUB_BUCKET_BITS bits after it
+size_t Histogram::GetBucketIdx(uint64_t value) {
+    value = min(value, MAX_BUCKET_VALUE);
+    if (value < SUB_BUCKET_COUNT) {
+        return value;
+    }
+    const int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return ((shift + 1) << SUB_BUCKET_BITS) + (value >> shift) - SUB_BUCKET_COUNT;
+}
+
+uint64_t Histogram::GetBucketValue(size_t bucket_idx) {
+    if (bucket_idx < SUB_BUCKET_COUNT) {
+        return bucket_idx;
+    }
+    const int shift = static_cast<int>(bucket_idx >> SUB_BUCKET_BITS) - 1;
+    const uint64_t top_bits = (bucket_idx & (SUB_BUCKET_COUNT - 1)) + SUB_BUCKET_COUNT;
+    return ((top_bits + 1) << shift) - 1;
+}
+
+uint64_t Histogram::GetCount() const {
+    uint64_t count = 0;
+    for (const uint64_t bucket_count : counts) {
+        count += bucket_count;
+    }
+    return count;
+}
+
+double Histogram::GetMean() const {
+    const uint64_t count = GetCount();
+    return count ? static_cast<double>(sum) / count : 0;
+}
+
+uint64_t Histogram::GetValueAtQuantile(double quantile) const {
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(ceil(quantile * GetCount())));
+    uint64_t count = 0;
+    for (size_t bucket_idx = 0; bucket_idx < counts.size(); ++bucket_idx) {
+        count += counts[bucket_idx];
+        if (count >= rank) {
+            return min(GetBucketValue(bucket_idx), max);
+        }
+    }
+    return 0;
+}
+
+// Only the owning thread changes a slot, so relaxed load and store are enough to count,
+// and readers of other threads see whole values
+static void Increase(atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+struct HistogramSlot {
+    array<atomic<uint64_t>, Histogram::BUCKET_COUNT> counts{};
+    atomic<uint64_t> sum{0};
+    atomic<uint64_t> max{0};
+
+    void Record(uint64_t value) {
+        Increase(counts[Histogram::GetBucketIdx(value)], 1);
+        Increase(sum, value);
+        if (value > max.load(memory_order_relaxed)) {
+            max.store(value, memory_order_relaxed);
+        }
+    }
+
+    void AddTo(Histogram &histogram) const {
+        for (size_t bucket_idx = 0; bucket_idx < counts.size(); ++bucket_idx) {
+            histogram.counts[bucket_idx] += counts[bucket_idx].load(memory_order_relaxed);
+        }
+        histogram.sum += sum.load(memory_order_relaxed);
+        histogram.max = std::max(histogram.max, max.load(memory_order_relaxed));
+    }
+};
+
+struct TypeSlot {
+    atomic<uint64_t> bytes{0};
+    atomic<uint64_t> cache_hits{0};
+    HistogramSlot latency_ns;
+};
+
+struct Slot {
+    array<TypeSlot, MAX_TYPE_COUNT> types;
+    HistogramSlot route_items;
+};
+
+// Requests are answered by the main thread or by the threads of a pool, which live as long as the pool,
+// so slots are never freed: counts of a finished thread stay in the sums
+class SlotRegistry {
+ public:
+    Slot *Add() {
+        lock_guard lock(mutex_);
+        return slots_.emplace_back(make_unique<Slot>()).get();
+    }
+
+    Snapshot Sum() const {
+        Snapshot snapshot;
+        lock_guard lock(mutex_);
+        for (const auto &slot : slots_) {
+            for (size_t type_idx = 0; type_idx < MAX_TYPE_COUNT; ++type_idx) {
+                const TypeSlot &type_slot = slot->types[type_idx];
+                TypeStats &type_stats = snapshot.types[type_idx];
+                type_stats.bytes += type_slot.bytes.load(memory_order_relaxed);
+                type_stats.cache_hits += type_slot.cache_hits.load(memory_order_relaxed);
+                type_slot.latency_ns.AddTo(type_stats.latency_ns);
+            }
+            slot->route_items.AddTo(snapshot.route_items);
+        }
+        return snapshot;
+    }
+
+ private:
+    mutable mutex mutex_;
+    vector<unique_ptr<Slot>> slots_;
+};
+
+// Never destroyed, threads may still finish while the process exits
+static SlotRegistry &GetRegistry() {
+    static auto *registry = new SlotRegistry;
+    return *registry;
+}
+
+static Slot &GetThreadSlot() {
+    thread_local Slot *slot = GetRegistry().Add();
+    return *slot;
+}
+
+void RecordRequest(size_t type_idx, chrono::steady_clock::duration latency, size_t byte_count) {
+    TypeSlot &type_slot = GetThreadSlot().types[type_idx];
+    Increase(type_slot.bytes, byte_count);
+    type_slot.latency_ns.Record(chrono::duration_cast<chrono::nanoseconds>(latency).count());
+}
+
+void RecordCacheHit(size_t type_idx) {
+    Increase(GetThreadSlot().types[type_idx].cache_hits, 1);
+}
+
+void RecordRouteItems(size_t item_count) {
+    GetThreadSlot().route_items.Record(item_count);
+}
+
+Snapshot TakeSnapshot() {
+    return GetRegistry().Sum();
+}
+
+}
@@ -1,115 +1,764 @@
 #include "requests.h"
+#include "request_metrics.h"
 #include "transport_router.h"
+#include "utils.h"
 
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 using namespace std;
 
 namespace Requests {
 
-Json::Dict Stop::Process(const TransportCatalog &db) const {
-    const auto *stop = db.GetStop(name);
-    Json::Dict dict;
-    if (!stop) {
-        dict["error_message"] = Json::Node("not found"s);
+static void WriteNotFound(int64_t request_id, Json::Writer &writer) {
+    writer.Key("error_message");
+    writer.Write("not found");
+    writer.Key("request_id");
+    writer.Write(request_id);
+}
+
+// Type letter, then the names, each but the last one prefixed with its size so that keys can't collide
+string Stop::GetCacheKey() const {
+    return "S" + name;
+}
+
+string Bus::GetCacheKey() const {
+    return "B" + name;
+}
+
+// Size of the first stop name, ':', then both names
+static string MakeRouteMapHandle(const string &stop_from, const string &stop_to) {
+    return to_string(stop_from.size()) + ':' + stop_from + stop_to;
+}
+
+// Stops of the route, nullopt if the handle is not made by MakeRouteMapHandle
+static optional<pair<string_view, string_view>> ParseRouteMapHandle(string_view handle) {
+    const size_t colon_pos = handle.find(':');
+    if (colon_pos == string_view::npos) {
+        return nullopt;
+    }
+    size_t from_size;
+    const char *size_end = handle.data() + colon_pos;
+    if (const auto [ptr, error] = from_chars(handle.data(), size_end, from_size); error != errc{} || ptr != size_end) {
+        return nullopt;
+    }
+    handle.remove_prefix(colon_pos + 1);
+    if (from_size > handle.size()) {
+        return nullopt;
+    }
+    return pair{handle.substr(0, from_size), handle.substr(from_size)};
+}
+
+// Handles outlive bases, e.g. a client may keep one across a reload, so a stop unknown to the base is not found
+// like a malformed handle or a missing route
+static optional<TransportRouter::RouteInfo> FindRouteByHandle(const TransportCatalog &db, string_view handle) {
+    const auto stops = ParseRouteMapHandle(handle);
+    if (!stops) {
+        return nullopt;
+    }
+    const auto stop_from = db.FindStop(stops->first);
+    const auto stop_to = db.FindStop(stops->second);
+    if (!stop_from || !stop_to) {
+        return nullopt;
+    }
+    return db.FindRoute(*stop_from, *stop_to);
+}
+
+string Route::GetCacheKey() const {
+    return "R" + to_string(static_cast<int>(map_mode)) + MakeRouteMapHandle(stop_from, stop_to);
+}
+
+string Map::GetCacheKey() const {
+    return "M";
+}
+
+string RouteMap::GetCacheKey() const {
+    return "H" + handle;
+}
+
+// Writes the response with the request_id value put back at request_id_pos
+static void WriteEncoded(string_view text, size_t request_id_pos, int64_t request_id, Json::Writer &writer) {
+    writer.WriteSerialized(text.substr(0, request_id_pos));
+    writer.WriteRaw(to_string(request_id));
+    writer.WriteRaw(text.substr(request_id_pos));
+}
+
+void Stop::Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const {
+    const auto stop_id = db.FindStop(name);
+    if (const auto *response = stop_id ? db.GetEncodedStop(*stop_id) : nullptr) {
+        WriteEncoded(response->text, response->request_id_pos, request_id, writer);
+        return;
+    }
+    writer.BeginObject();
+    if (!stop_id) {
+        WriteNotFound(request_id, writer);
     } else {
-        Json::Array bus_nodes;
-        bus_nodes.reserve(stop->bus_names.size());
-        for (const auto &bus_name : stop->bus_names) {
-            bus_nodes.emplace_back(bus_name);
+        writer.Key("buses");
+        writer.BeginArray();
+        for (const BusId bus_id : db.GetStop(*stop_id).bus_ids) {
+            writer.Write(db.GetBusName(bus_id));
         }
-        dict["buses"] = Json::Node(move(bus_nodes));
+        writer.EndArray();
+        writer.Key("request_id");
+        writer.Write(request_id);
     }
-    return dict;
+    writer.EndObject();
 }
 
-Json::Dict Bus::Process(const TransportCatalog &db) const {
-    const auto *bus = db.GetBus(name);
-    Json::Dict dict;
-    if (!bus) {
-        dict["error_message"] = Json::Node("not found"s);
+void Stop::Process(const TransportCatalog &db, TCProto::StatResponse &response) const {
+    const auto stop_id = db.FindStop(name);
+    if (!stop_id) {
+        response.set_error_message("not found");
+        return;
+    }
+    auto &info = *response.mutable_stop();
+    for (const BusId bus_id : db.GetStop(*stop_id).bus_ids) {
+        info.add_buses(db.GetBusName(bus_id));
+    }
+}
+
+void Bus::Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const {
+    const auto bus_id = db.FindBus(name);
+    if (const auto *response = bus_id ? db.GetEncodedBus(*bus_id) : nullptr) {
+        WriteEncoded(response->text, response->request_id_pos, request_id, writer);
+        return;
+    }
+    writer.BeginObject();
+    if (!bus_id) {
+        WriteNotFound(request_id, writer);
     } else {
-        dict = {
-            {"stop_count",        Json::Node(static_cast<int>(bus->stop_count))},
-            {"unique_stop_count", Json::Node(static_cast<int>(bus->unique_stop_count))},
-            {"route_length",      Json::Node(static_cast<int>(bus->road_route_length))},
-            {"curvature",         Json::Node(bus->road_route_length / bus->geo_route_length)},
-        };
+        const auto &bus = db.GetBus(*bus_id);
+        writer.Key("curvature");
+        writer.Write(bus.road_route_length / bus.geo_route_length);
+        writer.Key("request_id");
+        writer.Write(request_id);
+        writer.Key("route_length");
+        writer.Write(static_cast<int64_t>(bus.road_route_length));
+        writer.Key("stop_count");
+        writer.Write(static_cast<int>(bus.stop_count));
+        writer.Key("unique_stop_count");
+        writer.Write(static_cast<int>(bus.unique_stop_count));
     }
-    return dict;
+    writer.EndObject();
 }
 
-struct RouteItemResponseBuilder {
-    Json::Dict operator()(const TransportRouter::RouteInfo::BusItem &bus_item) const {
-        return Json::Dict{
-            {"type",       Json::Node("Bus"s)},
-            {"bus",        Json::Node(bus_item.bus_name)},
-            {"time",       Json::Node(bus_item.time)},
-            {"span_count", Json::Node(static_cast<int>(bus_item.span_count))}
-        };
+void Bus::Process(const TransportCatalog &db, TCProto::StatResponse &response) const {
+    const auto bus_id = db.FindBus(name);
+    if (!bus_id) {
+        response.set_error_message("not found");
+        return;
     }
+    const auto &bus = db.GetBus(*bus_id);
+    auto &info = *response.mutable_bus();
+    info.set_curvature(bus.road_route_length / bus.geo_route_length);
+    info.set_route_length(bus.road_route_length);
+    info.set_stop_count(bus.stop_count);
+    info.set_unique_stop_count(bus.unique_stop_count);
+}
 
-    Json::Dict operator()(const TransportRouter::RouteInfo::WaitItem &wait_item) const {
-        return Json::Dict{
-            {"type",      Json::Node("Wait"s)},
-            {"stop_name", Json::Node(wait_item.stop_name)},
-            {"time",      Json::Node(wait_item.time)},
-        };
+struct RouteItemResponseWriter {
+    const TransportCatalog &db;
+    Json::Writer &writer;
+
+    void operator()(const TransportRouter::RouteInfo::BusItem &bus_item) const {
+        writer.BeginObject();
+        writer.Key("bus");
+        writer.Write(db.GetBusName(bus_item.bus_id));
+        writer.Key("span_count");
+        writer.Write(static_cast<int>(bus_item.span_count));
+        writer.Key("time");
+        writer.Write(bus_item.time);
+        writer.Key("type");
+        writer.Write("Bus");
+        writer.EndObject();
+    }
+
+    void operator()(const TransportRouter::RouteInfo::WaitItem &wait_item) const {
+        writer.BeginObject();
+        writer.Key("stop_name");
+        writer.Write(db.GetStopName(wait_item.stop_id));
+        writer.Key("time");
+        writer.Write(wait_item.time);
+        writer.Key("type");
+        writer.Write("Wait");
+        writer.EndObject();
     }
 };
 
-Json::Dict Route::Process(const TransportCatalog &db) const {
-    Json::Dict dict;
+void Route::Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const {
     const auto route = db.FindRoute(stop_from, stop_to);
+    writer.BeginObject();
     if (!route) {
-        dict["error_message"] = Json::Node("not found"s);
+        WriteNotFound(request_id, writer);
     } else {
-        dict["total_time"] = Json::Node(route->total_time);
-        Json::Array items;
-        items.reserve(route->items.size());
+        Metrics::RecordRouteItems(route->items.size());
+        writer.Key("items");
+        writer.BeginArray();
         for (const auto &item : route->items) {
-            items.push_back(visit(RouteItemResponseBuilder{}, item));
+            visit(RouteItemResponseWriter{db, writer}, item);
+        }
+        writer.EndArray();
+        if (map_mode == RouteMapMode::Inline) {
+            writer.Key("map");
+            writer.WriteString([&db, &route](ostream &out) { db.RenderRoute(*route, out); });
+        } else if (map_mode == RouteMapMode::Deferred) {
+            writer.Key("map_handle");
+            writer.Write(MakeRouteMapHandle(stop_from, stop_to));
         }
+        writer.Key("request_id");
+        writer.Write(request_id);
+        writer.Key("total_time");
+        writer.Write(route->total_time);
+    }
+    writer.EndObject();
+}
 
-        dict["items"] = move(items);
+struct RouteItemProtoBuilder {
+    const TransportCatalog &db;
+    TCProto::RouteItem &proto;
 
-        dict["map"] = Json::Node(db.RenderRoute(*route));
+    void operator()(const TransportRouter::RouteInfo::BusItem &bus_item) const {
+        auto &item = *proto.mutable_bus();
+        item.set_bus(db.GetBusName(bus_item.bus_id));
+        item.set_span_count(bus_item.span_count);
+        item.set_time(bus_item.time);
     }
 
-    return dict;
+    void operator()(const TransportRouter::RouteInfo::WaitItem &wait_item) const {
+        auto &item = *proto.mutable_wait();
+        item.set_stop_name(db.GetStopName(wait_item.stop_id));
+        item.set_time(wait_item.time);
+    }
+};
+
+void Route::Process(const TransportCatalog &db, TCProto::StatResponse &response) const {
+    const auto route = db.FindRoute(stop_from, stop_to);
+    if (!route) {
+        response.set_error_message("not found");
+        return;
+    }
+    Metrics::RecordRouteItems(route->items.size());
+    auto &info = *response.mutable_route();
+    info.set_total_time(route->total_time);
+    for (const auto &item : route->items) {
+        visit(RouteItemProtoBuilder{db, *info.add_items()}, item);
+    }
+    if (map_mode == RouteMapMode::Inline) {
+        ostringstream map;
+        db.RenderRoute(*route, map);
+        info.set_map(map.str());
+    } else if (map_mode == RouteMapMode::Deferred) {
+        info.set_map_handle(MakeRouteMapHandle(stop_from, stop_to));
+    }
 }
 
-Json::Dict Map::Process(const TransportCatalog &db) const {
-    return Json::Dict{
-        {"map", Json::Node(db.RenderMap())},
-    };
+void Map::Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const {
+    writer.BeginObject();
+    writer.Key("map");
+    writer.WriteString([&db](ostream &out) { db.RenderMap(out); });
+    writer.Key("request_id");
+    writer.Write(request_id);
+    writer.EndObject();
+}
+
+void Map::Process(const TransportCatalog &db, TCProto::StatResponse &response) const {
+    ostringstream map;
+    db.RenderMap(map);
+    response.mutable_map()->set_map(map.str());
+}
+
+void RouteMap::Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const {
+    const auto route = FindRouteByHandle(db, handle);
+    writer.BeginObject();
+    if (!route) {
+        WriteNotFound(request_id, writer);
+    } else {
+        writer.Key("map");
+        writer.WriteString([&db, &route](ostream &out) { db.RenderRoute(*route, out); });
+        writer.Key("request_id");
+        writer.Write(request_id);
+    }
+    writer.EndObject();
+}
+
+void RouteMap::Process(const TransportCatalog &db, TCProto::StatResponse &response) const {
+    const auto route = FindRouteByHandle(db, handle);
+    if (!route) {
+        response.set_error_message("not found");
+        return;
+    }
+    ostringstream map;
+    db.RenderRoute(*route, map);
+    response.mutable_route_map()->set_map(map.str());
+}
+
+// In the order of Request alternatives, request metrics are recorded by the alternative index
+static const string_view REQUEST_TYPE_NAMES[] = {"Stop", "Bus", "Route", "Map", "RouteMap", "Stats"};
+static_assert(size(REQUEST_TYPE_NAMES) == variant_size_v<Request>);
+static_assert(variant_size_v<Request> <= Metrics::MAX_TYPE_COUNT);
+
+static constexpr double NS_PER_US = 1000;
+
+static const pair<string_view, double> QUANTILES[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+
+// Indices of the types with names in alphabetical order, the order of keys in the response
+static vector<size_t> GetTypeIdxsByName() {
+    vector<size_t> type_idxs(size(REQUEST_TYPE_NAMES));
+    for (size_t type_idx = 0; type_idx < type_idxs.size(); ++type_idx) {
+        type_idxs[type_idx] = type_idx;
+    }
+    sort(type_idxs.begin(), type_idxs.end(), [](size_t lhs, size_t rhs) {
+        return REQUEST_TYPE_NAMES[lhs] < REQUEST_TYPE_NAMES[rhs];
+    });
+    return type_idxs;
+}
+
+// Values are divided by scale, e.g. to get microseconds out of nanoseconds
+static void WriteDistribution(const Metrics::Histogram &histogram, double scale, Json::Writer &writer) {
+    writer.BeginObject();
+    writer.Key("count");
+    writer.Write(static_cast<int64_t>(histogram.GetCount()));
+    writer.Key("max");
+    writer.Write(histogram.max / scale);
+    writer.Key("mean");
+    writer.Write(histogram.GetMean() / scale);
+    for (const auto &[name, quantile] : QUANTILES) {
+        writer.Key(name);
+        writer.Write(histogram.GetValueAtQuantile(quantile) / scale);
+    }
+    writer.EndObject();
+}
+
+static void FillDistribution(const Metrics::Histogram &histogram, double scale, TCProto::Distribution &proto) {
+    proto.set_count(histogram.GetCount());
+    proto.set_max(histogram.max / scale);
+    proto.set_mean(histogram.GetMean() / scale);
+    proto.set_p50(histogram.GetValueAtQuantile(0.5) / scale);
+    proto.set_p90(histogram.GetValueAtQuantile(0.9) / scale);
+    proto.set_p99(histogram.GetValueAtQuantile(0.99) / scale);
+    proto.set_p999(histogram.GetValueAtQuantile(0.999) / scale);
+}
+
+static void PrintDistribution(const Metrics::Histogram &histogram, double scale, ostream &output) {
+    for (const auto &[name, quantile] : QUANTILES) {
+        output << ' ' << name << ' ' << histogram.GetValueAtQuantile(quantile) / scale;
+    }
+    output << " max " << histogram.max / scale << " mean " << histogram.GetMean() / scale;
+}
+
+void Stats::Process(const TransportCatalog &, int64_t request_id, Json::Writer &writer) const {
+    static const vector<size_t> TYPE_IDXS_BY_NAME = GetTypeIdxsByName();
+    const auto snapshot = Metrics::TakeSnapshot();
+    writer.BeginObject();
+    writer.Key("request_id");
+    writer.Write(request_id);
+    writer.Key("requests");
+    writer.BeginObject();
+    for (const size_t type_idx : TYPE_IDXS_BY_NAME) {
+        const auto &type_stats = snapshot.types[type_idx];
+        writer.Key(REQUEST_TYPE_NAMES[type_idx]);
+        writer.BeginObject();
+        writer.Key("bytes");
+        writer.Write(static_cast<int64_t>(type_stats.bytes));
+        writer.Key("cache_hits");
+        writer.Write(static_cast<int64_t>(type_stats.cache_hits));
+        writer.Key("latency_us");
+        WriteDistribution(type_stats.latency_ns, NS_PER_US, writer);
+        writer.EndObject();
+    }
+    writer.EndObject();
+    writer.Key("route_items");
+    WriteDistribution(snapshot.route_items, 1, writer);
+    writer.EndObject();
+}
+
+void Stats::Process(const TransportCatalog &, TCProto::StatResponse &response) const {
+    const auto snapshot = Metrics::TakeSnapshot();
+    auto &info = *response.mutable_stats();
+    for (size_t type_idx = 0; type_idx < size(REQUEST_TYPE_NAMES); ++type_idx) {
+        const auto &type_stats = snapshot.types[type_idx];
+        auto &type_info = *info.add_requests();
+        type_info.set_type(string(REQUEST_TYPE_NAMES[type_idx]));
+        type_info.set_bytes(type_stats.bytes);
+        type_info.set_cache_hits(type_stats.cache_hits);
+        FillDistribution(type_stats.latency_ns, NS_PER_US, *type_info.mutable_latency_us());
+    }
+    FillDistribution(snapshot.route_items, 1, *info.mutable_route_items());
+}
+
+void PrintStats(ostream &output) {
+    const auto snapshot = Metrics::TakeSnapshot();
+    for (size_t type_idx = 0; type_idx < size(REQUEST_TYPE_NAMES); ++type_idx) {
+        const auto &type_stats = snapshot.types[type_idx];
+        if (const uint64_t count = type_stats.latency_ns.GetCount()) {
+            output << REQUEST_TYPE_NAMES[type_idx] << ": " << count << " requests, latency us";
+            PrintDistribution(type_stats.latency_ns, NS_PER_US, output);
+            output << ", " << type_stats.bytes << " bytes, " << type_stats.cache_hits << " cache hits\n";
+        }
+    }
+    if (const uint64_t count = snapshot.route_items.GetCount()) {
+        output << "route items: " << count << " routes,";
+        PrintDistribution(snapshot.route_items, 1, output);
+        output << '\n';
+    }
 }
 
-variant<Stop, Bus, Route, Map> Read(const Json::Dict &attrs) {
-    const string &type = attrs.at("type").AsString();
+static RouteMapMode ReadRouteMapMode(string_view mode) {
+    if (mode == "inline") {
+        return RouteMapMode::Inline;
+    } else if (mode == "omit") {
+        return RouteMapMode::Omit;
+    } else if (mode == "deferred") {
+        return RouteMapMode::Deferred;
+    }
+    throw invalid_argument("unknown route map mode " + string(mode));
+}
+
+static RouteMapMode ReadRouteMapMode(TCProto::RouteMapMode mode) {
+    switch (mode) {
+        case TCProto::INLINE:
+            return RouteMapMode::Inline;
+        case TCProto::OMIT:
+            return RouteMapMode::Omit;
+        case TCProto::DEFERRED:
+            return RouteMapMode::Deferred;
+        default:
+            throw runtime_error("unknown route map mode " + to_string(mode));
+    }
+}
+
+template<typename DictType>
+static Request ReadImpl(const DictType &attrs) {
+    const string_view type = attrs.at("type").AsString();
     if (type == "Bus") {
-        return Bus{attrs.at("name").AsString()};
+        return Bus{string(attrs.at("name").AsString())};
     } else if (type == "Stop") {
-        return Stop{attrs.at("name").AsString()};
+        return Stop{string(attrs.at("name").AsString())};
     } else if (type == "Route") {
-        return Route{attrs.at("from").AsString(), attrs.at("to").AsString()};
+        return Route{
+            string(attrs.at("from").AsString()),
+            string(attrs.at("to").AsString()),
+            attrs.count("map") ? ReadRouteMapMode(attrs.at("map").AsString()) : RouteMapMode::Inline
+        };
+    } else if (type == "RouteMap") {
+        return RouteMap{string(attrs.at("handle").AsString())};
+    } else if (type == "Stats") {
+        return Stats{};
     } else {
         return Map{};
     }
 }
 
-Json::Array ProcessAll(const TransportCatalog &db, const Json::Array &requests) {
-    Json::Array responses;
-    responses.reserve(requests.size());
-    for (const Json::Node &request_node : requests) {
-        Json::Dict dict = visit([&db](const auto &request) {
-                                    return request.Process(db);
-                                },
-                                Requests::Read(request_node.AsMap()));
-        dict["request_id"] = Json::Node(request_node.AsMap().at("id").AsInt());
-        responses.push_back(Json::Node(dict));
+Request Read(const Json::Dict &attrs) {
+    return ReadImpl(attrs);
+}
+
+Request Read(const Json::View::Dict &attrs) {
+    return ReadImpl(attrs);
+}
+
+Request Read(const TCProto::StatRequest &request) {
+    switch (request.request_case()) {
+        case TCProto::StatRequest::kStop:
+            return Stop{request.stop().name()};
+        case TCProto::StatRequest::kBus:
+            return Bus{request.bus().name()};
+        case TCProto::StatRequest::kRoute:
+            return Route{request.route().from(), request.route().to(), ReadRouteMapMode(request.route().map_mode())};
+        case TCProto::StatRequest::kRouteMap:
+            return RouteMap{request.route_map().handle()};
+        case TCProto::StatRequest::kStats:
+            return Stats{};
+        default:
+            return Map{};
+    }
+}
+
+// Renders the response on its own and cuts the request_id value out of it. The key can't occur in string values,
+// their quotes are escaped, and only the top-level object has it
+template<typename RequestType>
+static Responses::Encoded EncodeResponse(const TransportCatalog &db, const RequestType &request) {
+    static const string_view REQUEST_ID_KEY = "\"request_id\": ";
+    static constexpr int REQUEST_ID = 0;
+    ostringstream text;
+    {
+        Json::Writer writer(text);
+        request.Process(db, REQUEST_ID, writer);
+    }
+    Responses::Encoded response{text.str()};
+    const size_t key_pos = response.text.find(REQUEST_ID_KEY);
+    if (key_pos == string::npos) {
+        throw logic_error("response has no request_id");
+    }
+    response.request_id_pos = key_pos + REQUEST_ID_KEY.size();
+    response.text.erase(response.request_id_pos, to_string(REQUEST_ID).size());
+    return response;
+}
+
+void EncodeResponses(TransportCatalog &db) {
+    db.EncodeResponses(
+        [&db](const string &name) { return EncodeResponse(db, Stop{name}); },
+        [&db](const string &name) { return EncodeResponse(db, Bus{name}); }
+    );
+}
+
+template<typename DictType>
+static void ProcessOne(const TransportCatalog &db, const DictType &attrs, Json::Writer &writer,
+                       ResponseCache *cache, DiskResponseCache *disk_cache) {
+    const auto start = chrono::steady_clock::now();
+    const size_t start_size = writer.GetSize();
+    const int64_t request_id = attrs.at("id").AsInt();
+    const Request request = Requests::Read(attrs);
+    const size_t type_idx = request.index();
+    visit([&db, request_id, &writer, cache, disk_cache, type_idx](const auto &typed_request) {
+        // Stats change with every request, so they are never cached
+        if constexpr (!is_same_v<decay_t<decltype(typed_request)>, Stats>) {
+            if (cache || disk_cache) {
+                string key = typed_request.GetCacheKey();
+                if (const auto response = cache ? cache->Find(key) : nullptr) {
+                    Metrics::RecordCacheHit(type_idx);
+                    WriteEncoded(response->text, response->request_id_pos, request_id, writer);
+                } else if (const auto disk_response = disk_cache ? disk_cache->Find(key) : nullopt) {
+                    Metrics::RecordCacheHit(type_idx);
+                    WriteEncoded(disk_response->text, disk_response->request_id_pos, request_id, writer);
+                } else {
+                    auto encoded = EncodeResponse(db, typed_request);
+                    WriteEncoded(encoded.text, encoded.request_id_pos, request_id, writer);
+                    if (disk_cache) {
+                        disk_cache->Insert(key, encoded.text, encoded.request_id_pos);
+                    }
+                    if (cache) {
+                        cache->Insert(move(key), make_shared<const ResponseCache::Response>(
+                            ResponseCache::Response{move(encoded.text), encoded.request_id_pos}
+                        ));
+                    }
+                }
+                return;
+            }
+        }
+        typed_request.Process(db, request_id, writer);
+    }, request);
+    Metrics::RecordRequest(type_idx, chrono::steady_clock::now() - start, writer.GetSize() - start_size);
+}
+
+// Requests only read the catalog, so they are answered by several threads at once.
+// A slow request holds back at most this many responses per thread, they wait in memory to be written in order,
+// and Route/Map ones carry whole SVG documents, so the window is small
+static constexpr size_t REORDER_WINDOW_SIZE_PER_THREAD = 16;
+
+// Answers requests on the threads of the pool and writes the responses in request order.
+// The calling thread finds the requests with locate(), which returns nullopt after the last one, and writes
+// the responses; it locates no further ahead than the window of responses not written yet.
+// Costs of requests differ a lot, e.g. Map vs Stop, so the pool threads take them one by one by index
+// instead of fixed chunks and answer each with process(request, writer)
+template<typename LocateFunc, typename ProcessFunc>
+static void ProcessParallel(ThreadPool &pool, Json::Writer &writer, LocateFunc locate, ProcessFunc process) {
+    using Request = typename decltype(locate())::value_type;
+    struct Slot {
+        Request request{};
+        string response;
+        exception_ptr error;
+        bool is_ready = false;
+    };
+    vector<Slot> window(REORDER_WINDOW_SIZE_PER_THREAD * pool.GetThreadCount());
+    atomic<size_t> next_idx = 0;
+    mutex mutex;
+    condition_variable request_located;
+    condition_variable response_ready;
+    // Under the mutex. Slot idx % window.size() belongs to request idx while written_count <= idx < located_count
+    size_t located_count = 0;
+    size_t written_count = 0;
+    bool is_located_all = false;
+
+    const auto answer = [&] {
+        ostringstream response_stream;
+        Json::Writer response_writer(response_stream);
+        while (true) {
+            const size_t idx = next_idx++;
+            unique_lock lock(mutex);
+            request_located.wait(lock, [&] { return idx < located_count || is_located_all; });
+            if (idx >= located_count) {
+                return;
+            }
+            lock.unlock();
+            Slot &slot = window[idx % window.size()];
+            bool is_failed = false;
+            try {
+                process(slot.request, response_writer);
+                response_writer.Flush();
+                slot.response = response_stream.str();
+            } catch (...) {
+                // The writer may be left in the middle of a response, and the error stops the whole run anyway
+                slot.error = current_exception();
+                is_failed = true;
+            }
+            response_stream.str({});
+            lock.lock();
+            slot.is_ready = true;
+            if (idx == written_count) {
+                response_ready.notify_one();
+            }
+            if (is_failed) {
+                return;
+            }
+        }
+    };
+
+    const auto write = [&] {
+        unique_lock lock(mutex);
+        while (true) {
+            bool is_located_any = false;
+            while (!is_located_all && located_count - written_count < window.size()) {
+                lock.unlock();
+                auto request = locate();
+                lock.lock();
+                if (request) {
+                    window[located_count++ % window.size()].request = move(*request);
+                } else {
+                    is_located_all = true;
+                }
+                is_located_any = true;
+            }
+            if (is_located_any) {
+                request_located.notify_all();
+            }
+            if (written_count == located_count) {
+                return;  // locating stops early only when the window is full, so all requests are answered
+            }
+            Slot &slot = window[written_count % window.size()];
+            response_ready.wait(lock, [&slot] { return slot.is_ready; });
+            const string response = move(slot.response);
+            const exception_ptr error = exchange(slot.error, nullptr);
+            slot.is_ready = false;
+            ++written_count;
+            lock.unlock();
+            if (error) {
+                rethrow_exception(error);
+            }
+            writer.WriteSerialized(response);
+            lock.lock();
+        }
+    };
+
+    pool.Run(answer, [&] {
+        try {
+            write();
+        } catch (...) {
+            // Lets the pool threads return once they are done with the requests they have taken
+            {
+                lock_guard lock(mutex);
+                is_located_all = true;
+            }
+            request_located.notify_all();
+            throw;
+        }
+    });
+}
+
+template<typename ArrayType>
+static void ProcessAllImpl(const TransportCatalog &db, const ArrayType &requests, ostream &output,
+                           ThreadPool *pool, ResponseCache *cache, DiskResponseCache *disk_cache) {
+    Json::Writer writer(output);
+    writer.BeginArray();
+    if (!pool) {
+        for (const auto &request_node : requests) {
+            ProcessOne(db, request_node.AsMap(), writer, cache, disk_cache);
+        }
+    } else {
+        size_t next_idx = 0;
+        ProcessParallel(
+            *pool, writer,
+            [&]() -> optional<size_t> {
+                return next_idx < requests.size() ? optional(next_idx++) : nullopt;
+            },
+            [&](size_t idx, Json::Writer &response_writer) {
+                ProcessOne(db, requests[idx].AsMap(), response_writer, cache, disk_cache);
+            }
+        );
+    }
+    writer.EndArray();
+}
+
+void ProcessAll(const TransportCatalog &db, const Json::Array &requests, ostream &output, ThreadPool *pool,
+                ResponseCache *cache, DiskResponseCache *disk_cache) {
+    ProcessAllImpl(db, requests, output, pool, cache, disk_cache);
+}
+
+void ProcessAll(const TransportCatalog &db, const Json::View::Array &requests, ostream &output,
+                ThreadPool *pool, ResponseCache *cache, DiskResponseCache *disk_cache) {
+    ProcessAllImpl(db, requests, output, pool, cache, disk_cache);
+}
+
+void ProcessStream(const TransportCatalog &db, Json::View::Reader &requests, ostream &output, ThreadPool *pool,
+                   ResponseCache *cache, DiskResponseCache *disk_cache) {
+    Json::Writer writer(output);
+    writer.BeginArray();
+    if (!pool) {
+        if (requests.EnterArray()) {
+            while (requests.NextItem()) {
+                const auto request_doc = requests.ReadValue();
+                ProcessOne(db, request_doc.GetRoot().AsMap(), writer, cache, disk_cache);
+            }
+        }
+    } else {
+        // Only the text of a request is found here, it is parsed by the thread that answers it
+        bool has_more = requests.EnterArray();
+        ProcessParallel(
+            *pool, writer,
+            [&]() -> optional<string_view> {
+                has_more = has_more && requests.NextItem();
+                return has_more ? optional(requests.SkipValue()) : nullopt;
+            },
+            [&](string_view request_text, Json::Writer &response_writer) {
+                const auto request_doc = Json::View::Load(request_text);
+                ProcessOne(db, request_doc.GetRoot().AsMap(), response_writer, cache, disk_cache);
+            }
+        );
+    }
+    writer.EndArray();
+}
+
+void ProcessBinaryStream(const TransportCatalog &db, istream &input, ostream &output) {
+    google::protobuf::io::IstreamInputStream input_stream(&input);
+    google::protobuf::io::OstreamOutputStream output_stream(&output);
+    TCProto::StatRequest request;
+    TCProto::StatResponse response;
+    bool clean_eof = false;
+    while (true) {
+        // Parsing merges into the message, so it is cleared before each one
+        request.Clear();
+        if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(&request, &input_stream, &clean_eof)) {
+            break;
+        }
+        const auto start = chrono::steady_clock::now();
+        response.Clear();
+        response.set_request_id(request.id());
+        const Request parsed_request = Read(request);
+        visit([&db, &response](const auto &typed_request) { typed_request.Process(db, response); }, parsed_request);
+        google::protobuf::util::SerializeDelimitedToZeroCopyStream(response, &output_stream);
+        // The size is computed by serializing, without the size prefix
+        Metrics::RecordRequest(parsed_request.index(), chrono::steady_clock::now() - start, response.GetCachedSize());
+    }
+    if (!clean_eof) {
+        throw runtime_error("malformed binary request stream");
     }
-    return responses;
 }
 
 }
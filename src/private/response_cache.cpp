@@ -0,0 +1,65 @@
+#include "response_cache.h"
+
+#include <functional>
+
+using namespace std;
+
+namespace Requests {
+
+ResponseCache::ResponseCache(size_t max_size_bytes)
+    : max_shard_size_bytes_(max_size_bytes / SHARD_COUNT), shards_(SHARD_COUNT) {
+}
+
+ResponseCache::Shard &ResponseCache::GetShard(string_view key) {
+    return shards_[hash<string_view>{}(key) % SHARD_COUNT];
+}
+
+shared_ptr<const ResponseCache::Response> ResponseCache::Find(string_view key) {
+    Shard &shard = GetShard(key);
+    {
+        lock_guard lock(shard.mutex);
+        if (const auto it = shard.index.find(key); it != shard.index.end()) {
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            ++hits_;
+            // Copying the text out happens after the lock is released, the pointer keeps it alive
+            return it->second->second;
+        }
+    }
+    ++misses_;
+    return nullptr;
+}
+
+void ResponseCache::Insert(string key, shared_ptr<const Response> response) {
+    const size_t entry_size = key.size() + response->text.size();
+    if (entry_size > max_shard_size_bytes_) {
+        return;
+    }
+    Shard &shard = GetShard(key);
+    lock_guard lock(shard.mutex);
+    if (shard.index.count(key)) {
+        return;  // another thread answered the same request meanwhile
+    }
+    shard.entries.emplace_front(move(key), move(response));
+    shard.index.emplace(shard.entries.front().first, shard.entries.begin());
+    shard.size_bytes += entry_size;
+    while (shard.size_bytes > max_shard_size_bytes_) {
+        const auto &[old_key, old_response] = shard.entries.back();
+        shard.size_bytes -= old_key.size() + old_response->text.size();
+        shard.index.erase(old_key);
+        shard.entries.pop_back();
+    }
+}
+
+ResponseCache::Stats ResponseCache::GetStats() const {
+    Stats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    for (const Shard &shard : shards_) {
+        lock_guard lock(shard.mutex);
+        stats.entry_count += shard.entries.size();
+        stats.size_bytes += shard.size_bytes;
+    }
+    return stats;
+}
+
+}
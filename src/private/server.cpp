@@ -0,0 +1,587 @@
+#include "server.h"
+#include "json_view.h"
+#include "json_writer.h"
+#include "requests.h"
+#include "response_cache.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace Server {
+
+static system_error MakeSystemError(const string &what) {
+    return system_error(errno, generic_category(), what);
+}
+
+// Closes the descriptor when it goes out of scope
+class FileDescriptor {
+ public:
+    explicit FileDescriptor(int fd = -1) : fd_(fd) {}
+
+    FileDescriptor(const FileDescriptor &) = delete;
+
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+    FileDescriptor(FileDescriptor &&other) noexcept : fd_(exchange(other.fd_, -1)) {}
+
+    FileDescriptor &operator=(FileDescriptor &&other) noexcept {
+        swap(fd_, other.fd_);
+        return *this;
+    }
+
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    int Get() const { return fd_; }
+
+ private:
+    int fd_;
+};
+
+struct RequestServer::Connection {
+    FileDescriptor fd;
+    string input;
+    size_t input_pos = 0;     // the part before it is already answered
+    string output;
+    size_t output_pos = 0;    // the part before it is already sent
+    bool input_closed = false;
+    bool is_broken = false;
+    uint32_t events = EPOLLIN;
+};
+
+// Responses in the cache come from the catalog, so they are replaced together
+struct RequestServer::Base {
+    shared_ptr<const TransportCatalog> db;
+    unique_ptr<Requests::ResponseCache> cache;  // null if caching is off
+};
+
+// Totals over all mappings of a process. Shared pages are the ones mapped by other processes too,
+// e.g. the base inherited by the workers of ServeWorkers; pss splits them evenly between those processes
+struct MemoryUsage {
+    size_t rss_kb = 0;
+    size_t pss_kb = 0;
+    size_t shared_kb = 0;
+    size_t private_kb = 0;
+};
+
+static MemoryUsage ReadMemoryUsage(const string &pid) {
+    const string file_name = "/proc/" + pid + "/smaps_rollup";
+    ifstream file(file_name);
+    if (!file) {
+        throw runtime_error("can't read " + file_name);
+    }
+    MemoryUsage usage;
+    string line;
+    while (getline(file, line)) {
+        istringstream fields(line);
+        string name;
+        size_t size_kb;
+        if (!(fields >> name >> size_kb)) {
+            continue;
+        }
+        if (name == "Rss:") {
+            usage.rss_kb = size_kb;
+        } else if (name == "Pss:") {
+            usage.pss_kb = size_kb;
+        } else if (name == "Shared_Clean:" || name == "Shared_Dirty:") {
+            usage.shared_kb += size_kb;
+        } else if (name == "Private_Clean:" || name == "Private_Dirty:") {
+            usage.private_kb += size_kb;
+        }
+    }
+    return usage;
+}
+
+// Old base is usually released by the time the new one is loaded, so the wait is rarely more than one poll
+static constexpr auto RELEASE_POLL_INTERVAL = chrono::milliseconds(10);
+
+RequestServer::RequestServer(BaseLoader load_base, size_t thread_count, size_t cache_size_bytes)
+    : load_base_(move(load_base)), thread_count_(thread_count), cache_size_bytes_(cache_size_bytes),
+      base_(LoadBase()) {
+}
+
+shared_ptr<RequestServer::Base> RequestServer::LoadBase() {
+    auto base = make_shared<Base>();
+    base->db = load_base_();
+    if (cache_size_bytes_ > 0) {
+        base->cache = make_unique<Requests::ResponseCache>(cache_size_bytes_);
+    }
+    return base;
+}
+
+ThreadPool *RequestServer::GetPool() {
+    if (thread_count_ <= 1) {
+        return nullptr;
+    }
+    call_once(pool_once_, [this] { pool_ = make_unique<ThreadPool>(thread_count_); });
+    return pool_.get();
+}
+
+RequestServer::~RequestServer() {
+    is_stopping_ = true;
+    if (signal_thread_.joinable()) {
+        pthread_kill(signal_thread_.native_handle(), reload_signal_);  // wakes sigwait up
+        signal_thread_.join();
+    }
+    lock_guard lock(reload_mutex_);
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+}
+
+void RequestServer::ProcessLine(string_view line, string &output) {
+    ostringstream responses;
+    try {
+        const auto document = Json::View::Load(line);
+        const auto &root = document.GetRoot();
+        if (root.IsMap()) {
+            if (const auto *command = root.AsMap().Find("control")) {
+                ProcessControl(command->AsString(), responses);
+                output += responses.str();
+                output += '\n';
+                return;
+            }
+        }
+        const auto &requests = root.IsMap() ? root.AsMap().at("stat_requests") : root;
+        if (!requests.IsArray()) {
+            throw invalid_argument("expected an array of stat requests");
+        }
+        // The whole document is answered from one base, even if a reload publishes another one meanwhile
+        const auto base = atomic_load(&base_);
+        Requests::ProcessAll(*base->db, requests.AsArray(), responses, GetPool(), base->cache.get());
+    } catch (const exception &error) {
+        responses.str({});
+        Json::Writer writer(responses);
+        writer.BeginObject();
+        writer.Key("error_message");
+        writer.Write(error.what());
+        writer.EndObject();
+    }
+    output += responses.str();
+    output += '\n';
+}
+
+void RequestServer::ProcessControl(string_view command, ostream &output) {
+    Json::Writer writer(output);
+    writer.BeginObject();
+    if (command == "memory") {
+        const MemoryUsage usage = ReadMemoryUsage("self");
+        writer.Key("pid");
+        writer.Write(static_cast<int>(getpid()));
+        for (const auto &[key, size_kb] : {pair{"rss_kb", usage.rss_kb}, pair{"pss_kb", usage.pss_kb},
+                                           pair{"shared_kb", usage.shared_kb}, pair{"private_kb", usage.private_kb}}) {
+            writer.Key(key);
+            writer.Write(static_cast<int>(size_kb));
+        }
+    } else if (command == "cache") {
+        const auto base = atomic_load(&base_);
+        const auto stats = base->cache ? base->cache->GetStats() : Requests::ResponseCache::Stats{};
+        for (const auto &[key, value] : {pair{"entry_count", stats.entry_count}, pair{"hits", stats.hits},
+                                         pair{"misses", stats.misses}, pair{"size_bytes", stats.size_bytes}}) {
+            writer.Key(key);
+            writer.Write(static_cast<int>(value));
+        }
+    } else if (command != "reload") {
+        writer.Key("error_message");
+        writer.Write("unknown control command");
+    } else if (Reload()) {
+        writer.Key("status");
+        writer.Write("reload started");
+    } else {
+        writer.Key("error_message");
+        writer.Write("reload is already running");
+    }
+    writer.EndObject();
+}
+
+bool RequestServer::Reload() {
+    if (parent_pid_ != 0) {
+        // Worker of ServeWorkers: the parent loads the base once for all workers and replaces them
+        return kill(parent_pid_, SIGHUP) == 0;
+    }
+    lock_guard lock(reload_mutex_);
+    if (is_reloading_) {
+        return false;
+    }
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();  // previous reload is over, only the thread is left
+    }
+    is_reloading_ = true;
+    reload_thread_ = thread([this] { LoadInBackground(); });
+    return true;
+}
+
+void RequestServer::LoadInBackground() {
+    try {
+        auto old_base = atomic_exchange(&base_, LoadBase());
+        // Documents that took the old base before the switch still hold it. Waiting for them here keeps
+        // its destruction, which takes a while for big bases, away from the threads that answer requests
+        while (old_base.use_count() > 1 && !is_stopping_) {
+            this_thread::sleep_for(RELEASE_POLL_INTERVAL);
+        }
+    } catch (const exception &error) {
+        cerr << "can't reload base: " << error.what() << '\n';
+    }
+    is_reloading_ = false;
+}
+
+void RequestServer::ReloadOnSignal(int signal_number) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signal_number);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    reload_signal_ = signal_number;
+    signal_thread_ = thread([this, signals] {
+        for (int signal; sigwait(&signals, &signal) == 0 && !is_stopping_;) {
+            Reload();
+        }
+    });
+}
+
+void RequestServer::Serve(istream &input, ostream &output) {
+    string line;
+    string answer;
+    while (getline(input, line)) {
+        if (Strip(line).empty()) {
+            continue;
+        }
+        answer.clear();
+        ProcessLine(line, answer);
+        // Client may wait for the answer before sending the next document
+        output << answer << flush;
+    }
+}
+
+static FileDescriptor Listen(const string &socket_path) {
+    sockaddr_un address{};
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw system_error(make_error_code(errc::filename_too_long), "can't listen on " + socket_path);
+    }
+    address.sun_family = AF_UNIX;
+    copy(begin(socket_path), end(socket_path), address.sun_path);
+
+    FileDescriptor listener(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if (listener.Get() < 0) {
+        throw MakeSystemError("can't create socket");
+    }
+    unlink(socket_path.c_str());  // left by a previous run, bind fails otherwise
+    if (bind(listener.Get(), reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        throw MakeSystemError("can't bind " + socket_path);
+    }
+    if (listen(listener.Get(), SOMAXCONN) != 0) {
+        throw MakeSystemError("can't listen on " + socket_path);
+    }
+    return listener;
+}
+
+void RequestServer::ServeSocket(const string &socket_path) {
+    const FileDescriptor listener = Listen(socket_path);
+    ServeConnections(listener.Get());
+}
+
+static void UpdateEpoll(int epoll_fd, int operation, int fd, uint32_t events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, operation, fd, &event) != 0) {
+        throw MakeSystemError("can't update epoll");
+    }
+}
+
+// Reads one buffer, epoll reports the rest on the next wait
+static void ReadInput(int fd, string &input, size_t &input_pos, bool &input_closed, bool &is_broken) {
+    input.erase(0, input_pos);
+    input_pos = 0;
+    char buffer[1 << 16];
+    ssize_t size;
+    do {
+        size = read(fd, buffer, sizeof(buffer));
+    } while (size < 0 && errno == EINTR);
+    if (size > 0) {
+        input.append(buffer, size);
+    } else if (size == 0) {
+        input_closed = true;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        is_broken = true;
+    }
+}
+
+// Sends as much as the socket takes without blocking
+static void WriteOutput(int fd, string &output, size_t &output_pos, bool &is_broken) {
+    while (output_pos < output.size()) {
+        const ssize_t size = send(fd, output.data() + output_pos, output.size() - output_pos, MSG_NOSIGNAL);
+        if (size >= 0) {
+            output_pos += size;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            is_broken = true;
+            return;
+        }
+    }
+    output.clear();
+    output_pos = 0;
+}
+
+bool RequestServer::AnswerNextLine(Connection &connection) {
+    while (connection.input_pos < connection.input.size()) {
+        const size_t line_begin = connection.input_pos;
+        size_t line_end = connection.input.find('\n', line_begin);
+        if (line_end == string::npos) {
+            // Client may finish without the trailing newline
+            if (!connection.input_closed) {
+                return false;
+            }
+            line_end = connection.input.size();
+        }
+        connection.input_pos = min(line_end + 1, connection.input.size());
+        const string_view line(connection.input.data() + line_begin, line_end - line_begin);
+        if (!Strip(line).empty()) {
+            ProcessLine(line, connection.output);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RequestServer::ServeConnections(int listener_fd, int stop_fd) {
+    const FileDescriptor epoll(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll.Get() < 0) {
+        throw MakeSystemError("can't create epoll");
+    }
+    UpdateEpoll(epoll.Get(), EPOLL_CTL_ADD, listener_fd, EPOLLIN);
+    if (stop_fd >= 0) {
+        UpdateEpoll(epoll.Get(), EPOLL_CTL_ADD, stop_fd, EPOLLIN);
+    }
+
+    unordered_map<int, Connection> connections;
+    bool is_draining = false;
+
+    const auto serve = [&](Connection &connection, uint32_t events) {
+        const int fd = connection.fd.Get();
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            ReadInput(fd, connection.input, connection.input_pos, connection.input_closed, connection.is_broken);
+        }
+        // Next line is answered only after the answer to the previous one is sent, so a client that
+        // sends many documents without reading the answers can't make the server buffer all of them
+        do {
+            WriteOutput(fd, connection.output, connection.output_pos, connection.is_broken);
+        } while (!connection.is_broken && connection.output.empty() && AnswerNextLine(connection));
+
+        const bool has_output = !connection.output.empty();
+        // While draining, lines the client sends after the answered ones are left to the other workers:
+        // the client sees the connection closed and connects again
+        if (connection.is_broken || ((connection.input_closed || is_draining) && !has_output)) {
+            // Closing the descriptor removes it from epoll
+            connections.erase(fd);
+            return;
+        }
+        // Reading stops while the client doesn't take the answer, the lines it sends meanwhile wait in the socket
+        const uint32_t events_wanted = has_output ? EPOLLOUT : EPOLLIN;
+        if (events_wanted != connection.events) {
+            UpdateEpoll(epoll.Get(), EPOLL_CTL_MOD, fd, events_wanted);
+            connection.events = events_wanted;
+        }
+    };
+
+    epoll_event events[64];
+    while (!is_draining || !connections.empty()) {
+        const int event_count = epoll_wait(epoll.Get(), events, static_cast<int>(size(events)), -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw MakeSystemError("can't wait for events");
+        }
+
+        for (const epoll_event &event : Range{events, events + event_count}) {
+            if (event.data.fd == listener_fd) {
+                for (int fd; !is_draining && (fd = accept4(listener_fd, nullptr, nullptr,
+                                                           SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+                    UpdateEpoll(epoll.Get(), EPOLL_CTL_ADD, fd, EPOLLIN);
+                    connections[fd].fd = FileDescriptor(fd);
+                }
+                continue;
+            }
+
+            if (event.data.fd == stop_fd) {
+                // Connections waiting in the backlog are accepted by the processes still listening
+                is_draining = true;
+                UpdateEpoll(epoll.Get(), EPOLL_CTL_DEL, listener_fd, 0);
+                UpdateEpoll(epoll.Get(), EPOLL_CTL_DEL, stop_fd, 0);
+                vector<int> fds;
+                for (const auto &[fd, connection] : connections) {
+                    fds.push_back(fd);
+                }
+                for (const int fd : fds) {
+                    Connection &connection = connections.at(fd);
+                    serve(connection, connection.events);
+                }
+                continue;
+            }
+
+            // Might be closed by the draining above
+            if (const auto it = connections.find(event.data.fd); it != connections.end()) {
+                serve(it->second, event.events);
+            }
+        }
+    }
+}
+
+int RequestServer::StartWorker(int listener_fd) {
+    const pid_t parent_pid = getpid();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        throw MakeSystemError("can't start worker");
+    }
+    if (pid == 0) {
+        parent_pid_ = parent_pid;
+        RunWorker(listener_fd);
+    }
+    return pid;
+}
+
+void RequestServer::RunWorker(int listener_fd) {
+    int exit_code = 0;
+    try {
+        // Nobody would stop or replace the worker once the parent is gone
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent_pid_) {
+            _exit(0);
+        }
+        // Signals are blocked since ServeWorkers, so they are only seen through the descriptor
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGTERM);
+        sigaddset(&stop_signals, SIGINT);
+        const FileDescriptor stop(signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC));
+        if (stop.Get() < 0) {
+            throw MakeSystemError("can't wait for signals");
+        }
+        ServeConnections(listener_fd, stop.Get());
+    } catch (const exception &error) {
+        cerr << "worker " << getpid() << " failed: " << error.what() << '\n';
+        exit_code = 1;
+    }
+    // Returning would run the destructors of everything the parent had on the stack, the base included,
+    // which only touches the shared pages for nothing
+    _exit(exit_code);
+}
+
+static void PrintMemoryUsage(const string &pid, const string &role, ostream &output) {
+    try {
+        const MemoryUsage usage = ReadMemoryUsage(pid);
+        output << role << ' ' << pid << ": rss " << usage.rss_kb << " kB, shared " << usage.shared_kb
+               << " kB, private " << usage.private_kb << " kB, pss " << usage.pss_kb << " kB\n";
+    } catch (const exception &error) {
+        // The worker may have just exited
+        output << role << ' ' << pid << ": " << error.what() << '\n';
+    }
+}
+
+void RequestServer::ServeWorkers(const string &socket_path, size_t worker_count) {
+    const FileDescriptor listener = Listen(socket_path);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    for (const int signal : {SIGCHLD, SIGHUP, SIGTERM, SIGINT, SIGUSR1}) {
+        sigaddset(&signals, signal);
+    }
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    // Workers share the pages the base has at fork, whatever is built later would be built by each of them
+    atomic_load(&base_)->db->WarmUp();
+    unordered_set<pid_t> workers;
+    unordered_set<pid_t> retiring;  // replaced by a reload, they answer what they have received and exit
+    const auto start_workers = [&] {
+        while (workers.size() < worker_count) {
+            workers.insert(StartWorker(listener.Get()));
+        }
+    };
+    start_workers();
+
+    bool is_stopping = false;
+    while (!is_stopping || !workers.empty() || !retiring.empty()) {
+        int signal;
+        if (sigwait(&signals, &signal) != 0) {
+            continue;
+        }
+        if (signal == SIGCHLD) {
+            int status;
+            for (pid_t pid; (pid = waitpid(-1, &status, WNOHANG)) > 0;) {
+                if (retiring.erase(pid) == 0 && workers.erase(pid) != 0 && !is_stopping) {
+                    cerr << "worker " << pid << " exited unexpectedly, starting another one\n";
+                }
+            }
+            if (!is_stopping) {
+                start_workers();
+            }
+        } else if (signal == SIGHUP) {
+            if (is_stopping) {
+                continue;
+            }
+            try {
+                auto base = LoadBase();
+                base->db->WarmUp();
+                atomic_store(&base_, move(base));
+            } catch (const exception &error) {
+                cerr << "can't reload base: " << error.what() << '\n';
+                continue;
+            }
+            // New workers start listening before the old ones stop, so clients are always accepted
+            for (const pid_t pid : workers) {
+                retiring.insert(pid);
+            }
+            workers.clear();
+            start_workers();
+            for (const pid_t pid : retiring) {
+                kill(pid, SIGTERM);
+            }
+        } else if (signal == SIGUSR1) {
+            PrintMemoryUsage(to_string(getpid()), "parent", cerr);
+            for (const auto &[pids, role] : {pair{&workers, "worker"}, pair{&retiring, "retiring worker"}}) {
+                for (const pid_t pid : *pids) {
+                    PrintMemoryUsage(to_string(pid), role, cerr);
+                }
+            }
+        } else if (!is_stopping) {
+            is_stopping = true;
+            for (const auto *pids : {&workers, &retiring}) {
+                for (const pid_t pid : *pids) {
+                    kill(pid, SIGTERM);
+                }
+            }
+        }
+    }
+}
+
+}
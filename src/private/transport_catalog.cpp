@@ -1,77 +1,160 @@
 #include "transport_catalog.h"
+#include "proto_sections.h"
 #include "utils.h"
 
-#include "transport_catalog.pb.h"
-
 #include <algorithm>
+#include <future>
 #include <iterator>
 #include <map>
+#include <memory>
 #include <optional>
-#include <sstream>
-#include <unordered_map>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
 
 using namespace std;
 
+template<typename Dict>
+static shared_ptr<const NameIndex> MakeNameIndex(const Dict &dict) {
+    vector<string> names;
+    names.reserve(dict.size());
+    for (const auto &[name, _] : dict) {
+        names.push_back(name);
+    }
+    return make_shared<const NameIndex>(move(names));
+}
+
 TransportCatalog::TransportCatalog(
     vector<Descriptions::InputQuery> data,
     const Json::Dict &routing_settings_json,
-    const Json::Dict &render_settings_json
-) {
-    auto stops_end = partition(begin(data), end(data), [](const auto &item) {
+    const Json::Dict &render_settings_json,
+    const TransportCatalog *previous
+) : descriptions_(move(data)) {
+    auto stops_end = partition(begin(descriptions_), end(descriptions_), [](const auto &item) {
         return holds_alternative<Descriptions::Stop>(item);
     });
 
     Descriptions::StopsDict stops_dict;
-    for (const auto &item : Range{begin(data), stops_end}) {
+    for (const auto &item : Range{begin(descriptions_), stops_end}) {
         const auto &stop = get<Descriptions::Stop>(item);
         stops_dict[stop.name] = &stop;
-        stops_.insert({stop.name, {}});
     }
 
     Descriptions::BusesDict buses_dict;
-    for (const auto &item : Range{stops_end, end(data)}) {
+    for (const auto &item : Range{stops_end, end(descriptions_)}) {
         const auto &bus = get<Descriptions::Bus>(item);
-
         buses_dict[bus.name] = &bus;
-        buses_[bus.name] = Bus{
-            bus.stops.size(),
-            ComputeUniqueItemsCount(AsRange(bus.stops)),
-            ComputeRoadRouteLength(bus.stops, stops_dict),
-            ComputeGeoRouteDistance(bus.stops, stops_dict)
-        };
+    }
+
+    stops_index_ = MakeNameIndex(stops_dict);
+    buses_index_ = MakeNameIndex(buses_dict);
+    stops_.resize(stops_index_->GetCount());
+    buses_.resize(buses_index_->GetCount());
+
+    unordered_set<string> unchanged_stops;
+    unordered_set<string> unchanged_buses;
+    if (previous) {
+        for (const auto &item : previous->descriptions_) {
+            if (const auto *stop = get_if<Descriptions::Stop>(&item)) {
+                if (const auto it = stops_dict.find(stop->name); it != stops_dict.end() && *it->second == *stop) {
+                    unchanged_stops.insert(stop->name);
+                }
+            } else {
+                const auto &bus = get<Descriptions::Bus>(item);
+                if (const auto it = buses_dict.find(bus.name); it != buses_dict.end() && *it->second == bus) {
+                    unchanged_buses.insert(bus.name);
+                }
+            }
+        }
+    }
+
+    // Buses go in the order of their ids, so the bus ids of each stop come sorted
+    for (const auto&[name, bus_ptr] : buses_dict) {
+        const auto &bus = *bus_ptr;
+        const BusId bus_id = buses_index_->At(name);
+        const bool is_unchanged = unchanged_buses.count(name) && all_of(
+            begin(bus.stops), end(bus.stops),
+            [&unchanged_stops](const string &stop_name) { return unchanged_stops.count(stop_name) > 0; }
+        );
+        if (is_unchanged) {
+            buses_[bus_id] = previous->buses_[previous->buses_index_->At(name)];
+        } else {
+            buses_[bus_id] = Bus{
+                bus.stops.size(),
+                ComputeUniqueItemsCount(AsRange(bus.stops)),
+                ComputeRoadRouteLength(bus.stops, stops_dict),
+                ComputeGeoRouteDistance(bus.stops, stops_dict)
+            };
+        }
 
         for (const string &stop_name : bus.stops) {
-            stops_.at(stop_name).bus_names.insert(bus.name);
+            auto &bus_ids = stops_[stops_index_->At(stop_name)].bus_ids;
+            if (bus_ids.empty() || bus_ids.back() != bus_id) {
+                bus_ids.push_back(bus_id);
+            }
         }
     }
 
-    router_ = make_unique<TransportRouter>(stops_dict, buses_dict, routing_settings_json);
+    if (previous) {
+        const TransportRouter::PreviousBase previous_router{
+            *previous->router_, *previous->stops_index_, *previous->buses_index_, unchanged_stops, unchanged_buses
+        };
+        router_ = make_unique<TransportRouter>(stops_dict, buses_dict, *stops_index_, *buses_index_,
+                                               routing_settings_json, &previous_router);
+    } else {
+        router_ = make_unique<TransportRouter>(stops_dict, buses_dict, *stops_index_, *buses_index_,
+                                               routing_settings_json);
+    }
+
+    map_renderer_ = make_unique<MapRenderer>(stops_dict, buses_dict, stops_index_, buses_index_, render_settings_json);
+}
+
+optional<StopId> TransportCatalog::FindStop(string_view name) const {
+    return stops_index_->Find(name);
+}
 
-    map_renderer_ = make_unique<MapRenderer>(stops_dict, buses_dict, render_settings_json);
+optional<BusId> TransportCatalog::FindBus(string_view name) const {
+    return buses_index_->Find(name);
 }
 
-const TransportCatalog::Stop *TransportCatalog::GetStop(const string &name) const {
-    return GetValuePointer(stops_, name);
+const Responses::Encoded *TransportCatalog::GetEncodedStop(StopId stop_id) const {
+    return encoded_stops_.empty() ? nullptr : &encoded_stops_[stop_id];
 }
 
-const TransportCatalog::Bus *TransportCatalog::GetBus(const string &name) const {
-    return GetValuePointer(buses_, name);
+const Responses::Encoded *TransportCatalog::GetEncodedBus(BusId bus_id) const {
+    return encoded_buses_.empty() ? nullptr : &encoded_buses_[bus_id];
 }
 
-optional<TransportRouter::RouteInfo> TransportCatalog::FindRoute(const string &stop_from, const string &stop_to) const {
-    return router_->FindRoute(stop_from, stop_to);
+void TransportCatalog::EncodeResponses(const ResponseEncoder &encode_stop, const ResponseEncoder &encode_bus) {
+    // Encoders may answer from this catalog, so the stored responses are replaced only at the end
+    vector<Responses::Encoded> encoded_stops;
+    encoded_stops.reserve(stops_.size());
+    for (StopId stop_id = 0; stop_id < stops_.size(); ++stop_id) {
+        encoded_stops.push_back(encode_stop(GetStopName(stop_id)));
+    }
+    vector<Responses::Encoded> encoded_buses;
+    encoded_buses.reserve(buses_.size());
+    for (BusId bus_id = 0; bus_id < buses_.size(); ++bus_id) {
+        encoded_buses.push_back(encode_bus(GetBusName(bus_id)));
+    }
+    encoded_stops_ = move(encoded_stops);
+    encoded_buses_ = move(encoded_buses);
 }
 
-string TransportCatalog::RenderMap() const {
-    ostringstream out;
+optional<TransportRouter::RouteInfo> TransportCatalog::FindRoute(string_view stop_from, string_view stop_to) const {
+    return router_->FindRoute(stops_index_->At(stop_from), stops_index_->At(stop_to));
+}
+
+void TransportCatalog::RenderMap(ostream &out) const {
     map_renderer_->Render().Render(out);
-    return out.str();
 }
 
-string TransportCatalog::RenderRoute(const TransportRouter::RouteInfo &route) const {
-    ostringstream out;
+void TransportCatalog::RenderRoute(const TransportRouter::RouteInfo &route, ostream &out) const {
     BuildRouteMap(route).Render(out);
-    return out.str();
+}
+
+void TransportCatalog::WarmUp() const {
+    map_renderer_->Render();
 }
 
 size_t TransportCatalog::ComputeRoadRouteLength(
@@ -102,55 +185,348 @@ Svg::Document TransportCatalog::BuildRouteMap(const TransportRouter::RouteInfo &
     return map_renderer_->RenderRoute(map_renderer_->Render(), route);
 }
 
+void TransportCatalog::SerializeStop(StopId stop_id, TCProto::StopResponse &proto) const {
+    proto.set_name(GetStopName(stop_id));
+    for (const BusId bus_id : stops_[stop_id].bus_ids) {
+        proto.add_bus_names(GetBusName(bus_id));
+    }
+}
+
+void TransportCatalog::SerializeBus(BusId bus_id, TCProto::BusResponse &proto) const {
+    const Bus &bus = buses_[bus_id];
+    proto.set_name(GetBusName(bus_id));
+    proto.set_stop_count(bus.stop_count);
+    proto.set_unique_stop_count(bus.unique_stop_count);
+    proto.set_road_route_length(bus.road_route_length);
+    proto.set_geo_route_length(bus.geo_route_length);
+}
+
+void TransportCatalog::SerializeEncoded(const string &name, const Responses::Encoded &response,
+                                        TCProto::EncodedResponse &proto) {
+    proto.set_name(name);
+    proto.set_text(response.text);
+    proto.set_request_id_pos(response.request_id_pos);
+}
+
 string TransportCatalog::Serialize() const {
     TCProto::TransportCatalog db_proto;
 
-    for (const auto&[name, stop] : stops_) {
-        TCProto::StopResponse &stop_proto = *db_proto.add_stops();
-        stop_proto.set_name(name);
-        for (const string &bus_name : stop.bus_names) {
-            stop_proto.add_bus_names(bus_name);
-        }
+    for (StopId stop_id = 0; stop_id < stops_.size(); ++stop_id) {
+        SerializeStop(stop_id, *db_proto.add_stops());
     }
 
-    for (const auto&[name, bus] : buses_) {
-        TCProto::BusResponse &bus_proto = *db_proto.add_buses();
-        bus_proto.set_name(name);
-        bus_proto.set_stop_count(bus.stop_count);
-        bus_proto.set_unique_stop_count(bus.unique_stop_count);
-        bus_proto.set_road_route_length(bus.road_route_length);
-        bus_proto.set_geo_route_length(bus.geo_route_length);
+    for (BusId bus_id = 0; bus_id < buses_.size(); ++bus_id) {
+        SerializeBus(bus_id, *db_proto.add_buses());
     }
 
-    router_->Serialize(*db_proto.mutable_router());
+    router_->Serialize(*db_proto.mutable_router(), *stops_index_, *buses_index_);
     map_renderer_->Serialize(*db_proto.mutable_renderer());
+    Descriptions::SerializeDescriptions(descriptions_, *db_proto.mutable_descriptions());
+
+    for (StopId stop_id = 0; stop_id < encoded_stops_.size(); ++stop_id) {
+        SerializeEncoded(GetStopName(stop_id), encoded_stops_[stop_id], *db_proto.add_encoded_stops());
+    }
+
+    for (BusId bus_id = 0; bus_id < encoded_buses_.size(); ++bus_id) {
+        SerializeEncoded(GetBusName(bus_id), encoded_buses_[bus_id], *db_proto.add_encoded_buses());
+    }
 
     return db_proto.SerializeAsString();
 }
 
-TransportCatalog TransportCatalog::Deserialize(const string &data) {
+// Encodes items with ids 0, ..., item_count - 1 as repeated field in parallel chunks, keeping the order of ids
+template<typename Proto, typename SerializeItem>
+static string SerializeRepeatedParallel(size_t item_count, int field_number, SerializeItem serialize_item) {
+    const auto chunks = TransformChunksParallel(item_count, GetWorkerCount(), [&](size_t begin, size_t end) {
+        string chunk;
+        Proto proto;
+        for (size_t item_idx = begin; item_idx < end; ++item_idx) {
+            proto.Clear();
+            serialize_item(static_cast<uint32_t>(item_idx), proto);
+            ProtoSections::AppendField(chunk, field_number, proto);
+        }
+        return chunk;
+    });
+
+    string result;
+    for (const string &chunk : chunks) {
+        result += chunk;
+    }
+    return result;
+}
+
+string TransportCatalog::Serialize(SectionTimings &timings) const {
+    using Proto = TCProto::TransportCatalog;
+
+    string stops_data;
+    auto stops_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            stops_data = SerializeRepeatedParallel<TCProto::StopResponse>(
+                stops_.size(), Proto::kStopsFieldNumber,
+                [this](StopId stop_id, TCProto::StopResponse &proto) { SerializeStop(stop_id, proto); }
+            );
+        });
+    });
+
+    string buses_data;
+    auto buses_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            buses_data = SerializeRepeatedParallel<TCProto::BusResponse>(
+                buses_.size(), Proto::kBusesFieldNumber,
+                [this](BusId bus_id, TCProto::BusResponse &proto) { SerializeBus(bus_id, proto); }
+            );
+        });
+    });
+
+    string router_data;
+    SectionTimings router_timings;
+    auto router_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            ProtoSections::AppendField(router_data, Proto::kRouterFieldNumber, router_->Serialize(router_timings, *stops_index_, *buses_index_));
+        });
+    });
+
+    string renderer_data;
+    auto renderer_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            TCProto::MapRenderer renderer_proto;
+            map_renderer_->Serialize(renderer_proto);
+            ProtoSections::AppendField(renderer_data, Proto::kRendererFieldNumber, renderer_proto);
+        });
+    });
+
+    string encoded_data;
+    auto encoded_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            encoded_data = SerializeRepeatedParallel<TCProto::EncodedResponse>(
+                encoded_stops_.size(), Proto::kEncodedStopsFieldNumber,
+                [this](StopId stop_id, TCProto::EncodedResponse &proto) {
+                    SerializeEncoded(GetStopName(stop_id), encoded_stops_[stop_id], proto);
+                }
+            );
+            encoded_data += SerializeRepeatedParallel<TCProto::EncodedResponse>(
+                encoded_buses_.size(), Proto::kEncodedBusesFieldNumber,
+                [this](BusId bus_id, TCProto::EncodedResponse &proto) {
+                    SerializeEncoded(GetBusName(bus_id), encoded_buses_[bus_id], proto);
+                }
+            );
+        });
+    });
+
+    string descriptions_data;
+    const auto descriptions_duration = MeasureDuration([&] {
+        TCProto::InputDescriptions descriptions_proto;
+        Descriptions::SerializeDescriptions(descriptions_, descriptions_proto);
+        ProtoSections::AppendField(descriptions_data, Proto::kDescriptionsFieldNumber, descriptions_proto);
+    });
+
+    timings.emplace_back("stops", stops_future.get());
+    timings.emplace_back("buses", buses_future.get());
+    timings.emplace_back("router", router_future.get());
+    move(begin(router_timings), end(router_timings), back_inserter(timings));
+    timings.emplace_back("renderer", renderer_future.get());
+    timings.emplace_back("descriptions", descriptions_duration);
+    timings.emplace_back("encoded responses", encoded_future.get());
+
+    string result;
+    result.reserve(stops_data.size() + buses_data.size() + router_data.size()
+                   + renderer_data.size() + descriptions_data.size() + encoded_data.size());
+    for (const string *section : {&stops_data, &buses_data, &router_data, &renderer_data, &descriptions_data,
+                                  &encoded_data}) {
+        result += *section;
+    }
+    return result;
+}
+
+TransportCatalog TransportCatalog::Deserialize(string_view data) {
     TCProto::TransportCatalog proto;
-    assert(proto.ParseFromString(data));
+    if (!proto.ParseFromArray(data.data(), static_cast<int>(data.size()))) {
+        throw runtime_error("malformed base");
+    }
 
     TransportCatalog catalog;
 
+    vector<string> stop_names;
+    stop_names.reserve(proto.stops_size());
+    for (const TCProto::StopResponse &stop_proto : proto.stops()) {
+        stop_names.push_back(stop_proto.name());
+    }
+    catalog.stops_index_ = make_shared<const NameIndex>(move(stop_names));
+
+    vector<string> bus_names;
+    bus_names.reserve(proto.buses_size());
+    for (const TCProto::BusResponse &bus_proto : proto.buses()) {
+        bus_names.push_back(bus_proto.name());
+    }
+    catalog.buses_index_ = make_shared<const NameIndex>(move(bus_names));
+
+    catalog.stops_.resize(catalog.stops_index_->GetCount());
     for (const TCProto::StopResponse &stop_proto : proto.stops()) {
-        Stop &stop = catalog.stops_[stop_proto.name()];
+        Stop &stop = catalog.stops_[catalog.stops_index_->At(stop_proto.name())];
         for (const string &bus_name : stop_proto.bus_names()) {
-            stop.bus_names.insert(bus_name);
+            stop.bus_ids.push_back(catalog.buses_index_->At(bus_name));
         }
     }
 
+    catalog.buses_.resize(catalog.buses_index_->GetCount());
     for (const TCProto::BusResponse &bus_proto : proto.buses()) {
-        Bus &bus = catalog.buses_[bus_proto.name()];
+        Bus &bus = catalog.buses_[catalog.buses_index_->At(bus_proto.name())];
         bus.stop_count = bus_proto.stop_count();
         bus.unique_stop_count = bus_proto.unique_stop_count();
         bus.road_route_length = bus_proto.road_route_length();
         bus.geo_route_length = bus_proto.geo_route_length();
     }
 
-    catalog.router_ = TransportRouter::Deserialize(proto.router());
-    catalog.map_renderer_ = MapRenderer::Deserialize(proto.renderer());
+    catalog.router_ = TransportRouter::Deserialize(proto.router(), *catalog.stops_index_, *catalog.buses_index_);
+    catalog.map_renderer_ = MapRenderer::Deserialize(proto.renderer(), catalog.stops_index_, catalog.buses_index_);
+    catalog.descriptions_ = Descriptions::DeserializeDescriptions(proto.descriptions());
+
+    for (const auto &[responses_proto, index, responses] : {
+        tuple{&proto.encoded_stops(), catalog.stops_index_.get(), &catalog.encoded_stops_},
+        tuple{&proto.encoded_buses(), catalog.buses_index_.get(), &catalog.encoded_buses_}
+    }) {
+        if (!responses_proto->empty()) {
+            responses->resize(index->GetCount());
+        }
+        for (const TCProto::EncodedResponse &response_proto : *responses_proto) {
+            (*responses)[index->At(response_proto.name())] = {response_proto.text(), response_proto.request_id_pos()};
+        }
+    }
+
+    return catalog;
+}
+
+template<typename Proto>
+static Proto ParseSection(string_view data) {
+    Proto proto;
+    if (!proto.ParseFromArray(data.data(), static_cast<int>(data.size()))) {
+        throw runtime_error("malformed base section");
+    }
+    return proto;
+}
+
+vector<TCProto::StopResponse> TransportCatalog::DeserializeStopNames(const vector<string_view> &stops_data) {
+    vector<TCProto::StopResponse> stop_protos;
+    stop_protos.reserve(stops_data.size());
+    vector<string> names;
+    names.reserve(stops_data.size());
+    for (const string_view stop_data : stops_data) {
+        names.push_back(stop_protos.emplace_back(ParseSection<TCProto::StopResponse>(stop_data)).name());
+    }
+    stops_index_ = make_shared<const NameIndex>(move(names));
+    return stop_protos;
+}
+
+void TransportCatalog::DeserializeStops(const vector<TCProto::StopResponse> &stop_protos) {
+    stops_.resize(stops_index_->GetCount());
+    for (const auto &stop_proto : stop_protos) {
+        Stop &stop = stops_[stops_index_->At(stop_proto.name())];
+        stop.bus_ids.reserve(stop_proto.bus_names_size());
+        for (const string &bus_name : stop_proto.bus_names()) {
+            stop.bus_ids.push_back(buses_index_->At(bus_name));
+        }
+    }
+}
+
+void TransportCatalog::DeserializeBuses(const vector<string_view> &buses_data) {
+    vector<TCProto::BusResponse> bus_protos;
+    bus_protos.reserve(buses_data.size());
+    vector<string> names;
+    names.reserve(buses_data.size());
+    for (const string_view bus_data : buses_data) {
+        names.push_back(bus_protos.emplace_back(ParseSection<TCProto::BusResponse>(bus_data)).name());
+    }
+    buses_index_ = make_shared<const NameIndex>(move(names));
+
+    buses_.resize(buses_index_->GetCount());
+    for (const auto &bus_proto : bus_protos) {
+        Bus &bus = buses_[buses_index_->At(bus_proto.name())];
+        bus.stop_count = bus_proto.stop_count();
+        bus.unique_stop_count = bus_proto.unique_stop_count();
+        bus.road_route_length = bus_proto.road_route_length();
+        bus.geo_route_length = bus_proto.geo_route_length();
+    }
+}
+
+void TransportCatalog::DeserializeEncoded(const vector<string_view> &responses_data, const NameIndex &index,
+                                          vector<Responses::Encoded> &responses) {
+    if (!responses_data.empty()) {
+        responses.resize(index.GetCount());
+    }
+    for (const string_view response_data : responses_data) {
+        auto response_proto = ParseSection<TCProto::EncodedResponse>(response_data);
+        responses[index.At(response_proto.name())] = {
+            move(*response_proto.mutable_text()), response_proto.request_id_pos()
+        };
+    }
+}
+
+// Serialize always writes these sections, so a base without one of them is cut short
+static string_view GetRequiredSection(const vector<ProtoSections::Field> &fields, int number) {
+    const auto payloads = ProtoSections::CollectPayloads(fields, number);
+    if (payloads.empty()) {
+        throw runtime_error("malformed base: missing section " + to_string(number));
+    }
+    return payloads.back();
+}
+
+TransportCatalog TransportCatalog::Deserialize(string_view data, SectionTimings &timings) {
+    using Proto = TCProto::TransportCatalog;
+    const auto fields = ProtoSections::Split(data);
+
+    TransportCatalog catalog;
+
+    // Names of stops and buses come first: the other sections are resolved to ids with their indices
+    auto buses_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            catalog.DeserializeBuses(ProtoSections::CollectPayloads(fields, Proto::kBusesFieldNumber));
+        });
+    });
+
+    vector<TCProto::StopResponse> stop_protos;
+    auto stops_duration = MeasureDuration([&] {
+        stop_protos = catalog.DeserializeStopNames(ProtoSections::CollectPayloads(fields, Proto::kStopsFieldNumber));
+    });
+    const auto buses_duration = buses_future.get();
+
+    SectionTimings router_timings;
+    auto router_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            catalog.router_ = TransportRouter::Deserialize(
+                GetRequiredSection(fields, Proto::kRouterFieldNumber), router_timings,
+                *catalog.stops_index_, *catalog.buses_index_
+            );
+        });
+    });
+
+    auto encoded_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            DeserializeEncoded(ProtoSections::CollectPayloads(fields, Proto::kEncodedStopsFieldNumber),
+                               *catalog.stops_index_, catalog.encoded_stops_);
+            DeserializeEncoded(ProtoSections::CollectPayloads(fields, Proto::kEncodedBusesFieldNumber),
+                               *catalog.buses_index_, catalog.encoded_buses_);
+        });
+    });
+
+    auto renderer_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            catalog.map_renderer_ = MapRenderer::Deserialize(
+                ParseSection<TCProto::MapRenderer>(GetRequiredSection(fields, Proto::kRendererFieldNumber)),
+                catalog.stops_index_, catalog.buses_index_
+            );
+        });
+    });
+
+    stops_duration += MeasureDuration([&] {
+        catalog.DeserializeStops(stop_protos);
+    });
+
+    timings.emplace_back("stops", stops_duration);
+    timings.emplace_back("buses", buses_duration);
+    timings.emplace_back("router", router_future.get());
+    move(begin(router_timings), end(router_timings), back_inserter(timings));
+    timings.emplace_back("renderer", renderer_future.get());
+    timings.emplace_back("encoded responses", encoded_future.get());
 
     return catalog;
 }
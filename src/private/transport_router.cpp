@@ -1,45 +1,69 @@
 #include "transport_router.h"
+#include "proto_sections.h"
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include <future>
+#include <stdexcept>
 
 using namespace std;
+using google::protobuf::io::CodedInputStream;
+
+static const int GRAPH_FIELD_NUMBER = TCProto::TransportRouter::kGraphFieldNumber;
+static const int ROUTER_FIELD_NUMBER = TCProto::TransportRouter::kRouterFieldNumber;
+static const int SOURCES_DATA_FIELD_NUMBER = GraphProto::Router::kSourcesDataFieldNumber;
 
 
 TransportRouter::TransportRouter(const Descriptions::StopsDict &stops_dict,
                                  const Descriptions::BusesDict &buses_dict,
-                                 const Json::Dict &routing_settings_json)
+                                 const NameIndex &stops,
+                                 const NameIndex &buses,
+                                 const Json::Dict &routing_settings_json,
+                                 const PreviousBase *previous)
     : routing_settings_(MakeRoutingSettings(routing_settings_json)) {
     const size_t vertex_count = stops_dict.size() * 2;
     vertices_info_.resize(vertex_count);
     graph_ = BusGraph(vertex_count);
 
-    FillGraphWithStops(stops_dict);
-    FillGraphWithBuses(stops_dict, buses_dict);
+    FillGraphWithStops(stops_dict, stops);
+    FillGraphWithBuses(stops_dict, buses_dict, stops, buses);
 
-    router_ = std::make_unique<Router>(graph_);
+    const bool same_settings = previous
+                               && previous->router.routing_settings_.bus_wait_time == routing_settings_.bus_wait_time
+                               && previous->router.routing_settings_.bus_velocity == routing_settings_.bus_velocity;
+    if (same_settings) {
+        const auto previous_routes = MakePreviousRoutes(*previous, stops, buses);
+        router_ = std::make_unique<Router>(graph_, &previous_routes);
+    } else {
+        router_ = std::make_unique<Router>(graph_);
+    }
 }
 
 TransportRouter::RoutingSettings TransportRouter::MakeRoutingSettings(const Json::Dict &json) {
     return {
-        json.at("bus_wait_time").AsInt(),
+        static_cast<int>(json.at("bus_wait_time").AsInt()),
         json.at("bus_velocity").AsDouble(),
     };
 }
 
-void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict &stops_dict) {
+void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict &stops_dict, const NameIndex &stops) {
     Graph::VertexId vertex_id = 0;
 
+    stops_vertex_ids_.resize(stops.GetCount());
     for (const auto&[stop_name, _] : stops_dict) {
-        auto &vertex_ids = stops_vertex_ids_[stop_name];
+        const StopId stop_id = stops.At(stop_name);
+        auto &vertex_ids = stops_vertex_ids_[stop_id];
         vertex_ids.in = vertex_id++;
         vertex_ids.out = vertex_id++;
-        vertices_info_[vertex_ids.in] = {stop_name};
-        vertices_info_[vertex_ids.out] = {stop_name};
+        vertices_info_[vertex_ids.in] = {stop_id};
+        vertices_info_[vertex_ids.out] = {stop_id};
 
         edges_info_.emplace_back(WaitEdgeInfo{});
-        const Graph::EdgeId edge_id = graph_.AddEdge({
-                                                         vertex_ids.out,
-                                                         vertex_ids.in,
-                                                         static_cast<double>(routing_settings_.bus_wait_time)
-                                                     });
+        [[maybe_unused]] const Graph::EdgeId edge_id = graph_.AddEdge({
+            vertex_ids.out,
+            vertex_ids.in,
+            static_cast<double>(routing_settings_.bus_wait_time)
+        });
         assert(edge_id == edges_info_.size() - 1);
     }
 
@@ -47,57 +71,213 @@ void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict &stops_di
 }
 
 void TransportRouter::FillGraphWithBuses(const Descriptions::StopsDict &stops_dict,
-                                         const Descriptions::BusesDict &buses_dict) {
+                                         const Descriptions::BusesDict &buses_dict,
+                                         const NameIndex &stops,
+                                         const NameIndex &buses) {
     for (const auto&[_, bus_item] : buses_dict) {
         const auto &bus = *bus_item;
         const size_t stop_count = bus.stops.size();
         if (stop_count <= 1) {
             continue;
         }
+        const BusId bus_id = buses.At(bus.name);
+        vector<StopId> stop_ids(stop_count);
+        for (size_t stop_idx = 0; stop_idx < stop_count; ++stop_idx) {
+            stop_ids[stop_idx] = stops.At(bus.stops[stop_idx]);
+        }
         auto compute_distance_from = [&stops_dict, &bus](size_t lhs_idx) {
             return Descriptions::ComputeStopsDistance(*stops_dict.at(bus.stops[lhs_idx]),
                                                       *stops_dict.at(bus.stops[lhs_idx + 1]));
         };
         for (size_t start_stop_idx = 0; start_stop_idx + 1 < stop_count; ++start_stop_idx) {
-            const Graph::VertexId start_vertex = stops_vertex_ids_[bus.stops[start_stop_idx]].in;
-            int total_distance = 0;
+            const Graph::VertexId start_vertex = stops_vertex_ids_[stop_ids[start_stop_idx]].in;
+            size_t total_distance = 0;
             for (size_t finish_stop_idx = start_stop_idx + 1; finish_stop_idx < stop_count; ++finish_stop_idx) {
                 total_distance += compute_distance_from(finish_stop_idx - 1);
                 edges_info_.emplace_back(BusEdgeInfo{
-                    .bus_name = bus.name,
+                    .bus_id = bus_id,
                     .start_stop_idx = start_stop_idx,
                     .finish_stop_idx = finish_stop_idx,
                 });
-                const Graph::EdgeId edge_id = graph_.AddEdge({
-                                                                 start_vertex,
-                                                                 stops_vertex_ids_[bus.stops[finish_stop_idx]].out,
-                                                                 total_distance * 1.0 /
-                                                                 (routing_settings_.bus_velocity * 1000.0 /
-                                                                  60)  // m / (km/h * 1000 / 60) = min
-                                                             });
+                [[maybe_unused]] const Graph::EdgeId edge_id = graph_.AddEdge({
+                    start_vertex,
+                    stops_vertex_ids_[stop_ids[finish_stop_idx]].out,
+                    // m / (km/h * 1000 / 60) = min
+                    total_distance * 1.0 / (routing_settings_.bus_velocity * 1000.0 / 60)
+                });
                 assert(edge_id == edges_info_.size() - 1);
             }
         }
     }
 }
 
-void TransportRouter::Serialize(TCProto::TransportRouter &proto) const {
-    auto &routing_settings_proto = *proto.mutable_routing_settings();
-    routing_settings_proto.set_bus_wait_time(routing_settings_.bus_wait_time);
-    routing_settings_proto.set_bus_velocity(routing_settings_.bus_velocity);
+TransportRouter::EdgesById TransportRouter::FindEdgesById() const {
+    EdgesById edges_by_id;
+    edges_by_id.wait_edges.resize(stops_vertex_ids_.size());
+    // Going backwards, the first edge of each bus is the last one stored
+    for (Graph::EdgeId edge_id = edges_info_.size(); edge_id-- > 0;) {
+        if (const auto *bus_edge_info = get_if<BusEdgeInfo>(&edges_info_[edge_id])) {
+            if (bus_edge_info->bus_id >= edges_by_id.first_bus_edges.size()) {
+                edges_by_id.first_bus_edges.resize(bus_edge_info->bus_id + 1);
+            }
+            edges_by_id.first_bus_edges[bus_edge_info->bus_id] = edge_id;
+        } else {
+            edges_by_id.wait_edges[vertices_info_[graph_.GetEdge(edge_id).from].stop_id] = edge_id;
+        }
+    }
+    return edges_by_id;
+}
 
+TransportRouter::Router::PreviousRoutes TransportRouter::MakePreviousRoutes(const PreviousBase &previous,
+                                                                            const NameIndex &stops,
+                                                                            const NameIndex &buses) const {
+    const TransportRouter &previous_router = previous.router;
+
+    auto previous_components = Graph::ComputeWeakComponents(previous_router.graph_);
+    vector<size_t> previous_component_ids(previous_router.graph_.GetVertexCount());
+    vector<size_t> previous_component_bus_counts(previous_components.size());
+    for (size_t component_id = 0; component_id < previous_components.size(); ++component_id) {
+        unordered_set<BusId> bus_ids;
+        for (const Graph::VertexId vertex : previous_components[component_id]) {
+            previous_component_ids[vertex] = component_id;
+            for (const Graph::EdgeId edge_id : previous_router.graph_.GetIncidentEdges(vertex)) {
+                if (const auto *bus_edge_info = get_if<BusEdgeInfo>(&previous_router.edges_info_[edge_id])) {
+                    bus_ids.insert(bus_edge_info->bus_id);
+                }
+            }
+        }
+        previous_component_bus_counts[component_id] = bus_ids.size();
+    }
+
+    // Ids of the two bases differ, so stops and buses are matched by names
+    auto map_component = [
+        this, &previous, &stops, &buses,
+        previous_components = move(previous_components),
+        previous_component_ids = move(previous_component_ids),
+        previous_component_bus_counts = move(previous_component_bus_counts)
+    ](const vector<Graph::VertexId> &component) -> optional<vector<Graph::VertexId>> {
+        vector<Graph::VertexId> previous_vertices;
+        previous_vertices.reserve(component.size());
+        unordered_set<BusId> bus_ids;
+        for (const Graph::VertexId vertex : component) {
+            const StopId stop_id = vertices_info_[vertex].stop_id;
+            const string &stop_name = stops.GetName(stop_id);
+            if (!previous.unchanged_stops.count(stop_name)) {
+                return nullopt;
+            }
+            const auto &previous_vertex_ids = previous.router.stops_vertex_ids_[previous.stops.At(stop_name)];
+            const bool is_in_vertex = stops_vertex_ids_[stop_id].in == vertex;
+            previous_vertices.push_back(is_in_vertex ? previous_vertex_ids.in : previous_vertex_ids.out);
+            for (const Graph::EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+                if (const auto *bus_edge_info = get_if<BusEdgeInfo>(&edges_info_[edge_id])) {
+                    if (!previous.unchanged_buses.count(buses.GetName(bus_edge_info->bus_id))) {
+                        return nullopt;
+                    }
+                    bus_ids.insert(bus_edge_info->bus_id);
+                }
+            }
+        }
+
+        // Unchanged stops and buses must also form exactly the same component before the update
+        const size_t previous_component_id = previous_component_ids[previous_vertices.front()];
+        if (previous_components[previous_component_id].size() != component.size()
+            || previous_component_bus_counts[previous_component_id] != bus_ids.size()) {
+            return nullopt;
+        }
+        for (const Graph::VertexId previous_vertex : previous_vertices) {
+            if (previous_component_ids[previous_vertex] != previous_component_id) {
+                return nullopt;
+            }
+        }
+        return previous_vertices;
+    };
+
+    // Edges of unchanged buses and stops keep their relative order, so it is enough to shift them
+    auto map_edge = [
+        &previous, &stops, &buses, previous_edges = previous_router.FindEdgesById(), edges = FindEdgesById()
+    ](Graph::EdgeId previous_edge_id) {
+        const auto &edge_info = previous.router.edges_info_[previous_edge_id];
+        if (const auto *bus_edge_info = get_if<BusEdgeInfo>(&edge_info)) {
+            const BusId previous_bus_id = bus_edge_info->bus_id;
+            const BusId bus_id = buses.At(previous.buses.GetName(previous_bus_id));
+            return edges.first_bus_edges.at(bus_id)
+                   + (previous_edge_id - previous_edges.first_bus_edges.at(previous_bus_id));
+        }
+        const Graph::VertexId previous_vertex = previous.router.graph_.GetEdge(previous_edge_id).from;
+        const StopId previous_stop_id = previous.router.vertices_info_[previous_vertex].stop_id;
+        return edges.wait_edges.at(stops.At(previous.stops.GetName(previous_stop_id)));
+    };
+
+    return {*previous_router.router_, move(map_component), move(map_edge)};
+}
+
+void TransportRouter::Serialize(TCProto::TransportRouter &proto, const NameIndex &stops, const NameIndex &buses) const {
+    SerializeMetadata(proto, stops, buses);
     graph_.Serialize(*proto.mutable_graph());
     router_->Serialize(*proto.mutable_router());
+}
+
+string TransportRouter::Serialize(SectionTimings &timings, const NameIndex &stops, const NameIndex &buses) const {
+    string graph_data;
+    auto graph_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            GraphProto::DirectedWeightedGraph graph_proto;
+            graph_.Serialize(graph_proto);
+            ProtoSections::AppendField(graph_data, GRAPH_FIELD_NUMBER, graph_proto);
+        });
+    });
 
-    for (const auto&[name, vertex_ids] : stops_vertex_ids_) {
+    string matrix_data;
+    auto matrix_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            ProtoSections::AppendField(matrix_data, ROUTER_FIELD_NUMBER, router_->Serialize());
+        });
+    });
+
+    string metadata_data;
+    const auto metadata_duration = MeasureDuration([&] {
+        TCProto::TransportRouter metadata_proto;
+        SerializeMetadata(metadata_proto, stops, buses);
+        metadata_data = metadata_proto.SerializeAsString();
+    });
+
+    timings.emplace_back("router.graph", graph_future.get());
+    timings.emplace_back("router.matrix", matrix_future.get());
+    timings.emplace_back("router.metadata", metadata_duration);
+
+    // Keep fields ordered by number like protobuf does
+    string result;
+    const auto metadata_fields = ProtoSections::Split(metadata_data);
+    for (const auto &field : metadata_fields) {
+        if (field.number < GRAPH_FIELD_NUMBER) {
+            result += field.bytes;
+        }
+    }
+    result += graph_data;
+    result += matrix_data;
+    for (const auto &field : metadata_fields) {
+        if (field.number > ROUTER_FIELD_NUMBER) {
+            result += field.bytes;
+        }
+    }
+    return result;
+}
+
+void TransportRouter::SerializeMetadata(TCProto::TransportRouter &proto,
+                                        const NameIndex &stops, const NameIndex &buses) const {
+    auto &routing_settings_proto = *proto.mutable_routing_settings();
+    routing_settings_proto.set_bus_wait_time(routing_settings_.bus_wait_time);
+    routing_settings_proto.set_bus_velocity(routing_settings_.bus_velocity);
+
+    for (StopId stop_id = 0; stop_id < stops_vertex_ids_.size(); ++stop_id) {
         auto &vertex_ids_proto = *proto.add_stops_vertex_ids();
-        vertex_ids_proto.set_name(name);
-        vertex_ids_proto.set_in(vertex_ids.in);
-        vertex_ids_proto.set_out(vertex_ids.out);
+        vertex_ids_proto.set_name(stops.GetName(stop_id));
+        vertex_ids_proto.set_in(stops_vertex_ids_[stop_id].in);
+        vertex_ids_proto.set_out(stops_vertex_ids_[stop_id].out);
     }
 
-    for (const auto&[stop_name] : vertices_info_) {
-        proto.add_vertices_info()->set_stop_name(stop_name);
+    for (const auto&[stop_id] : vertices_info_) {
+        proto.add_vertices_info()->set_stop_name(stops.GetName(stop_id));
     }
 
     for (const auto &edge_info : edges_info_) {
@@ -105,7 +285,7 @@ void TransportRouter::Serialize(TCProto::TransportRouter &proto) const {
         if (holds_alternative<BusEdgeInfo>(edge_info)) {
             const auto &bus_edge_info = get<BusEdgeInfo>(edge_info);
             auto &bus_edge_info_proto = *edge_info_proto.mutable_bus_data();
-            bus_edge_info_proto.set_bus_name(bus_edge_info.bus_name);
+            bus_edge_info_proto.set_bus_name(buses.GetName(bus_edge_info.bus_id));
             bus_edge_info_proto.set_start_stop_idx(bus_edge_info.start_stop_idx);
             bus_edge_info_proto.set_finish_stop_idx(bus_edge_info.finish_stop_idx);
         } else {
@@ -114,36 +294,97 @@ void TransportRouter::Serialize(TCProto::TransportRouter &proto) const {
     }
 }
 
-unique_ptr<TransportRouter> TransportRouter::Deserialize(const TCProto::TransportRouter &proto) {
+unique_ptr<TransportRouter> TransportRouter::Deserialize(const TCProto::TransportRouter &proto,
+                                                         const NameIndex &stops, const NameIndex &buses) {
     unique_ptr<TransportRouter> router_holder(new TransportRouter);  // ctor is private, so can't use make_unique
     TransportRouter &router = *router_holder;
 
-    auto &routing_settings = router.routing_settings_;
-    routing_settings.bus_wait_time = proto.routing_settings().bus_wait_time();
-    routing_settings.bus_velocity = proto.routing_settings().bus_velocity();
-
     router.graph_ = BusGraph::Deserialize(proto.graph());
     router.router_ = Router::Deserialize(proto.router(), router.graph_);
+    router.DeserializeMetadata(proto, stops, buses);
+
+    return router_holder;
+}
 
+unique_ptr<TransportRouter> TransportRouter::Deserialize(string_view data, SectionTimings &timings,
+                                                         const NameIndex &stops, const NameIndex &buses) {
+    unique_ptr<TransportRouter> router_holder(new TransportRouter);
+    TransportRouter &router = *router_holder;
+
+    const auto fields = ProtoSections::Split(data);
+
+    auto graph_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            GraphProto::DirectedWeightedGraph graph_proto;
+            for (const string_view payload : ProtoSections::CollectPayloads(fields, GRAPH_FIELD_NUMBER)) {
+                CodedInputStream input(reinterpret_cast<const uint8_t *>(payload.data()), static_cast<int>(payload.size()));
+                if (!graph_proto.MergeFromCodedStream(&input)) {
+                    throw runtime_error("malformed base section");
+                }
+            }
+            router.graph_ = BusGraph::Deserialize(graph_proto);
+        });
+    });
+
+    // Router keeps only a reference to the graph, so the matrix can be decoded while the graph is being filled
+    auto matrix_future = async(launch::async, [&] {
+        return MeasureDuration([&] {
+            vector<string_view> sources_data;
+            for (const string_view payload : ProtoSections::CollectPayloads(fields, ROUTER_FIELD_NUMBER)) {
+                for (const string_view row : ProtoSections::CollectPayloads(ProtoSections::Split(payload),
+                                                                              SOURCES_DATA_FIELD_NUMBER)) {
+                    sources_data.push_back(row);
+                }
+            }
+            router.router_ = Router::Deserialize(sources_data, router.graph_);
+        });
+    });
+
+    const auto metadata_duration = MeasureDuration([&] {
+        TCProto::TransportRouter metadata_proto;
+        for (const auto &field : fields) {
+            if (field.number != GRAPH_FIELD_NUMBER && field.number != ROUTER_FIELD_NUMBER) {
+                CodedInputStream input(reinterpret_cast<const uint8_t *>(field.bytes.data()), static_cast<int>(field.bytes.size()));
+                if (!metadata_proto.MergeFromCodedStream(&input)) {
+                    throw runtime_error("malformed base section");
+                }
+            }
+        }
+        router.DeserializeMetadata(metadata_proto, stops, buses);
+    });
+
+    timings.emplace_back("router.graph", graph_future.get());
+    timings.emplace_back("router.matrix", matrix_future.get());
+    timings.emplace_back("router.metadata", metadata_duration);
+
+    return router_holder;
+}
+
+void TransportRouter::DeserializeMetadata(const TCProto::TransportRouter &proto,
+                                          const NameIndex &stops, const NameIndex &buses) {
+    routing_settings_.bus_wait_time = proto.routing_settings().bus_wait_time();
+    routing_settings_.bus_velocity = proto.routing_settings().bus_velocity();
+
+    stops_vertex_ids_.resize(stops.GetCount());
     for (const auto &stop_vertex_ids_proto : proto.stops_vertex_ids()) {
-        router.stops_vertex_ids_[stop_vertex_ids_proto.name()] = {
+        stops_vertex_ids_[stops.At(stop_vertex_ids_proto.name())] = {
             stop_vertex_ids_proto.in(),
             stop_vertex_ids_proto.out(),
         };
     }
 
-    router.vertices_info_.reserve(proto.vertices_info_size());
+    vertices_info_.reserve(proto.vertices_info_size());
     for (const auto &vertex_info_proto : proto.vertices_info()) {
-        router.vertices_info_.emplace_back().stop_name = vertex_info_proto.stop_name();
+        vertices_info_.emplace_back().stop_id = stops.At(vertex_info_proto.stop_name());
     }
 
-    router.edges_info_.reserve(proto.edges_info_size());
+    edges_info_.reserve(proto.edges_info_size());
     for (const auto &edge_info_proto : proto.edges_info()) {
-        auto &edge_info = router.edges_info_.emplace_back();
+        auto &edge_info = edges_info_.emplace_back();
         if (edge_info_proto.has_bus_data()) {
             const auto &bus_info_proto = edge_info_proto.bus_data();
             edge_info = BusEdgeInfo{
-                bus_info_proto.bus_name(),
+                buses.At(bus_info_proto.bus_name()),
                 bus_info_proto.start_stop_idx(),
                 bus_info_proto.finish_stop_idx(),
             };
@@ -151,28 +392,27 @@ unique_ptr<TransportRouter> TransportRouter::Deserialize(const TCProto::Transpor
             edge_info = WaitEdgeInfo{};
         }
     }
-
-    return router_holder;
 }
 
-optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string &stop_from, const string &stop_to) const {
-    const Graph::VertexId vertex_from = stops_vertex_ids_.at(stop_from).out;
-    const Graph::VertexId vertex_to = stops_vertex_ids_.at(stop_to).out;
-    const auto route = router_->BuildRoute(vertex_from, vertex_to);
+optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(StopId stop_from, StopId stop_to) const {
+    const Graph::VertexId vertex_from = stops_vertex_ids_[stop_from].out;
+    const Graph::VertexId vertex_to = stops_vertex_ids_[stop_to].out;
+    // Expanded by value: with requests answered on several threads the shared route cache of the router
+    // would be locked for every edge
+    const auto route = router_->ExpandRoute(vertex_from, vertex_to);
     if (!route) {
         return nullopt;
     }
 
-    RouteInfo route_info = {.total_time = route->weight};
-    route_info.items.reserve(route->edge_count);
-    for (size_t edge_idx = 0; edge_idx < route->edge_count; ++edge_idx) {
-        const Graph::EdgeId edge_id = router_->GetRouteEdge(route->id, edge_idx);
+    RouteInfo route_info = {.total_time = route->weight, .items = {}};
+    route_info.items.reserve(route->edges.size());
+    for (const Graph::EdgeId edge_id : route->edges) {
         const auto &edge = graph_.GetEdge(edge_id);
         const auto &edge_info = edges_info_[edge_id];
         if (holds_alternative<BusEdgeInfo>(edge_info)) {
             const auto &bus_edge_info = get<BusEdgeInfo>(edge_info);
             route_info.items.emplace_back(RouteInfo::BusItem{
-                .bus_name = bus_edge_info.bus_name,
+                .bus_id = bus_edge_info.bus_id,
                 .time = edge.weight,
                 .start_stop_idx = bus_edge_info.start_stop_idx,
                 .finish_stop_idx = bus_edge_info.finish_stop_idx,
@@ -181,14 +421,11 @@ optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string &st
         } else {
             const Graph::VertexId vertex_id = edge.from;
             route_info.items.emplace_back(RouteInfo::WaitItem{
-                .stop_name = vertices_info_[vertex_id].stop_name,
+                .stop_id = vertices_info_[vertex_id].stop_id,
                 .time = edge.weight,
             });
         }
     }
 
-    // Releasing in destructor of some proxy object would be better,
-    // but we do not expect exceptions in normal workflow
-    router_->ReleaseRoute(route->id);
     return route_info;
 }
@@ -2,9 +2,88 @@
 
 #include <cctype>
 #include <cmath>
+#include <cstring>
 
 using namespace std;
 
+size_t GetWorkerCount() {
+    return max(1u, thread::hardware_concurrency());
+}
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    threads_.reserve(thread_count);
+    for (size_t thread_idx = 0; thread_idx < thread_count; ++thread_idx) {
+        threads_.emplace_back([this] { Work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(mutex_);
+        is_stopping_ = true;
+    }
+    job_started_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Run(const function<void()> &worker_job, const function<void()> &caller_job) {
+    lock_guard run_lock(run_mutex_);
+    {
+        lock_guard lock(mutex_);
+        job_ = &worker_job;
+        ++job_number_;
+        running_count_ = threads_.size();
+        worker_error_ = nullptr;
+    }
+    job_started_.notify_all();
+
+    exception_ptr caller_error;
+    try {
+        caller_job();
+    } catch (...) {
+        caller_error = current_exception();
+    }
+
+    unique_lock lock(mutex_);
+    job_finished_.wait(lock, [this] { return running_count_ == 0; });
+    job_ = nullptr;
+    if (caller_error) {
+        rethrow_exception(caller_error);
+    }
+    if (worker_error_) {
+        rethrow_exception(exchange(worker_error_, nullptr));
+    }
+}
+
+void ThreadPool::Work() {
+    size_t done_job_number = 0;
+    unique_lock lock(mutex_);
+    while (true) {
+        job_started_.wait(lock, [this, done_job_number] { return is_stopping_ || job_number_ != done_job_number; });
+        if (is_stopping_) {
+            return;
+        }
+        done_job_number = job_number_;
+        const function<void()> &job = *job_;
+        lock.unlock();
+        exception_ptr error;
+        try {
+            job();
+        } catch (...) {
+            error = current_exception();
+        }
+        lock.lock();
+        if (error && !worker_error_) {
+            worker_error_ = error;
+        }
+        if (--running_count_ == 0) {
+            job_finished_.notify_one();
+        }
+    }
+}
+
 string_view Strip(string_view line) {
     while (!line.empty() && isspace(line.front())) {
         line.remove_prefix(1);
@@ -18,3 +97,36 @@ string_view Strip(string_view line) {
 bool IsZero(double x) {
     return abs(x) < 1e-6;
 }
+
+static uint64_t RotateLeft(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+// Single lane of xxHash64. A multiplication carries the bits of a word only upwards, so the rotation after it
+// brings the high ones back down: otherwise changes of the top bits of two words cancel each other out
+uint64_t ComputeHash(string_view data) {
+    static constexpr uint64_t PRIME_1 = 11400714785074694791ull;
+    static constexpr uint64_t PRIME_2 = 14029467366897019727ull;
+    static constexpr uint64_t PRIME_3 = 1609587929392839161ull;
+    static constexpr uint64_t PRIME_4 = 9650029242287828579ull;
+    static constexpr uint64_t PRIME_5 = 2870177450012600261ull;
+    uint64_t hash = PRIME_5 + data.size();
+    size_t pos = 0;
+    for (; pos + sizeof(uint64_t) <= data.size(); pos += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data.data() + pos, sizeof(word));
+        hash ^= RotateLeft(word * PRIME_2, 31) * PRIME_1;
+        hash = RotateLeft(hash, 27) * PRIME_1 + PRIME_4;
+    }
+    for (; pos < data.size(); ++pos) {
+        hash ^= static_cast<unsigned char>(data[pos]) * PRIME_5;
+        hash = RotateLeft(hash, 11) * PRIME_1;
+    }
+    // Every bit of the result depends on every bit of the state
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
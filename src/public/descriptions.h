@@ -1,12 +1,14 @@
 #pragma once
 
 #include "json.h"
+#include "json_view.h"
 #include "sphere.h"
 
 #include "descriptions.pb.h"
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
@@ -20,8 +22,16 @@ struct Stop {
     std::unordered_map<std::string, size_t> distances;
 
     static Stop ParseFrom(const Json::Dict &attrs);
+
+    static Stop ParseFrom(const Json::View::Dict &attrs);
+
+    void Serialize(TCProto::StopDescription &proto) const;
+
+    static Stop Deserialize(const TCProto::StopDescription &proto);
 };
 
+bool operator==(const Stop &lhs, const Stop &rhs);
+
 size_t ComputeStopsDistance(const Stop &lhs, const Stop &rhs);
 
 struct Bus {
@@ -31,15 +41,31 @@ struct Bus {
 
     static Bus ParseFrom(const Json::Dict &attrs);
 
+    static Bus ParseFrom(const Json::View::Dict &attrs);
+
     void Serialize(TCProto::BusDescription &proto) const;
 
     static Bus Deserialize(const TCProto::BusDescription &proto);
 };
 
+bool operator==(const Bus &lhs, const Bus &rhs);
+
 using InputQuery = std::variant<Stop, Bus>;
 
 std::vector<InputQuery> ReadDescriptions(const Json::Array &nodes);
 
+std::vector<InputQuery> ReadDescriptions(const Json::View::Array &nodes);
+
+// Converts the items of the base_requests array as they are read, so that only one item is parsed at a time
+std::vector<InputQuery> ReadDescriptions(Json::View::Reader &nodes);
+
+// Takes the text of the base_requests array, parses and converts its items on all cores
+std::vector<InputQuery> ReadDescriptions(std::string_view nodes_text);
+
+void SerializeDescriptions(const std::vector<InputQuery> &descriptions, TCProto::InputDescriptions &proto);
+
+std::vector<InputQuery> DeserializeDescriptions(const TCProto::InputDescriptions &proto);
+
 template<typename Object>
 using Dict = std::map<std::string, const Object *>;
 
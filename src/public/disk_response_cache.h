@@ -0,0 +1,70 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Requests {
+
+// Encoded JSON responses kept in a file across runs, for request batches replayed against the same base.
+// Keys and texts are the same as ResponseCache ones. The file is an append-only log: a header with the version of
+// the base, then records each holding the key, the response text without the request_id value and its position.
+// Records of previous runs are read in place from the memory mapping, the index of them is built on opening;
+// responses of this run are only appended, repeats within a run are for ResponseCache.
+// A file of another base or of another format is replaced by an empty one. Several threads and processes may
+// use the same file: each record is appended with one write under an exclusive flock, a record cut short
+// by a crash is dropped by the next opening
+class DiskResponseCache {
+ public:
+    struct Response {
+        std::string_view text;  // without the request_id value
+        size_t request_id_pos;  // where the request_id value goes
+    };
+
+    // Responses are kept only while all of these match, so a rebuilt base drops them even if its hash doesn't change
+    struct BaseVersion {
+        uint64_t hash;
+        uint64_t size;
+        int64_t modification_time_ns;
+    };
+
+    // Throws std::system_error if the file can't be opened, created or mapped
+    DiskResponseCache(const std::string &file_name, const BaseVersion &base_version);
+
+    DiskResponseCache(const DiskResponseCache &) = delete;
+
+    DiskResponseCache &operator=(const DiskResponseCache &) = delete;
+
+    ~DiskResponseCache();
+
+    // Only responses stored by previous runs
+    std::optional<Response> Find(std::string_view key) const;
+
+    // Appends the response unless it is stored already. If appending fails the error is printed to stderr
+    // once and nothing more is appended, the responses are not lost for the current run anyway
+    void Insert(const std::string &key, std::string_view text, size_t request_id_pos);
+
+ private:
+    std::string file_name_;
+    int fd_ = -1;
+    std::optional<MappedFile> file_;
+    std::unordered_map<std::string_view, Response> index_;
+
+    std::mutex append_mutex_;
+    std::unordered_set<std::string> appended_keys_;
+    bool is_append_failed_ = false;
+
+    // Opens the file of the base, replacing the one of another base, and leaves it locked
+    void OpenLocked(const BaseVersion &base_version);
+
+    // Indexes the records and drops a broken tail, if any
+    void ReadRecords();
+};
+
+}
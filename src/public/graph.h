@@ -5,6 +5,7 @@
 
 #include <cstdlib>
 #include <deque>
+#include <numeric>
 #include <type_traits>
 #include <vector>
 
@@ -127,4 +128,37 @@ DirectedWeightedGraph<Weight>::Deserialize(const GraphProto::DirectedWeightedGra
 
     return graph;
 }
+
+// Vertices of each weakly connected component in increasing order, components are ordered by their first vertex
+template<typename Weight>
+std::vector<std::vector<VertexId>> ComputeWeakComponents(const DirectedWeightedGraph<Weight> &graph) {
+    const size_t vertex_count = graph.GetVertexCount();
+    std::vector<VertexId> parent(vertex_count);
+    std::iota(std::begin(parent), std::end(parent), 0);
+    auto find_root = [&parent](VertexId vertex) {
+        while (parent[vertex] != vertex) {
+            vertex = parent[vertex] = parent[parent[vertex]];
+        }
+        return vertex;
+    };
+    for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+        const auto &edge = graph.GetEdge(edge_id);
+        const VertexId from_root = find_root(edge.from);
+        const VertexId to_root = find_root(edge.to);
+        parent[std::max(from_root, to_root)] = std::min(from_root, to_root);
+    }
+
+    std::vector<std::vector<VertexId>> components;
+    std::vector<size_t> root_component(vertex_count);
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+        const VertexId root = find_root(vertex);
+        if (root == vertex) {
+            root_component[vertex] = components.size();
+            components.emplace_back();
+        }
+        components[root_component[root]].push_back(vertex);
+    }
+    return components;
+}
+
 }
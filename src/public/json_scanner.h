@@ -0,0 +1,421 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Json {
+
+// Lexical layer shared by the parsers working on contiguous buffers.
+// End of the buffer behaves like end of stream: Peek and NextToken return '\0'
+class Scanner {
+ public:
+    explicit Scanner(std::string_view input) : pos_(input.data()), end_(input.data() + input.size()) {}
+
+    const char *GetPosition() const {
+        return pos_;
+    }
+
+    char Peek() const {
+        return pos_ < end_ ? *pos_ : '\0';
+    }
+
+    // Skips whitespace and returns the next character without consuming it
+    char PeekToken() {
+        pos_ = SkipSpaces(pos_, end_);
+        return Peek();
+    }
+
+    // Skips whitespace and consumes the next character
+    char NextToken() {
+        PeekToken();
+        return pos_ < end_ ? *pos_++ : '\0';
+    }
+
+    // Returns the character consumed by the last NextToken, which must not have been the end of the buffer
+    void Unget() {
+        --pos_;
+    }
+
+    struct RawString {
+        std::string_view raw;  // contents between the quotes, escape sequences are kept as is
+        bool has_escapes;
+    };
+
+    // Opening quote must be already consumed, closing one is consumed too.
+    // Throws std::invalid_argument on a raw control character, JSON allows them only escaped
+    RawString ScanString() {
+        const char *begin = pos_;
+        bool has_escapes = false;
+        while ((pos_ = FindQuoteBackslashOrControl(pos_, end_)) < end_ && *pos_ != '"') {
+            if (*pos_ != '\\') {
+                throw std::invalid_argument("unescaped control character in JSON string");
+            }
+            has_escapes = true;
+            pos_ += 2;
+        }
+        pos_ = std::min(pos_, end_);
+        const std::string_view raw(begin, pos_ - begin);
+        if (pos_ < end_) {
+            ++pos_;
+        }
+        return {raw, has_escapes};
+    }
+
+    // Writes at most raw.size() characters to output, returns their count.
+    // \uXXXX escapes, including surrogate pairs, are written as UTF-8
+    static size_t Unescape(std::string_view raw, char *output) {
+        char *out = output;
+        const char *pos = raw.data();
+        const char *end = raw.data() + raw.size();
+        while (pos < end) {
+            const auto *backslash = static_cast<const char *>(std::memchr(pos, '\\', end - pos));
+            const char *run_end = backslash && backslash + 1 < end ? backslash : end;
+            out = std::copy(pos, run_end, out);
+            if (run_end == end) {
+                break;
+            }
+            const char c = run_end[1];
+            pos = run_end + 2;
+            if (c == 'u') {
+                pos = UnescapeCodePoint(pos, end, out);
+            } else {
+                *out++ = UnescapeChar(c);
+            }
+        }
+        return out - output;
+    }
+
+    static std::string Unescape(std::string_view raw) {
+        std::string result(raw.size(), '\0');
+        result.resize(Unescape(raw, result.data()));
+        return result;
+    }
+
+    std::string ScanUnescapedString() {
+        const auto[raw, has_escapes] = ScanString();
+        return has_escapes ? Unescape(raw) : std::string(raw);
+    }
+
+    // Skips the next value without interpreting it, returns its text
+    std::string_view SkipValue() {
+        const char first = PeekToken();
+        const char *begin = pos_;
+        if (first == '[' || first == '{') {
+            // Only brackets outside of strings matter, the rest is not even tokenized
+            size_t depth = 0;
+            while (pos_ < end_) {
+                const char c = *pos_++;
+                if (c == '"') {
+                    ScanString();
+                } else if (c == '[' || c == '{') {
+                    ++depth;
+                } else if ((c == ']' || c == '}') && --depth == 0) {
+                    break;
+                }
+            }
+        } else if (first == '"') {
+            ++pos_;
+            ScanString();
+        } else {
+            while (pos_ < end_ && !IsSpace(*pos_) && *pos_ != ',' && *pos_ != ']' && *pos_ != '}') {
+                ++pos_;
+            }
+        }
+        return {begin, static_cast<size_t>(pos_ - begin)};
+    }
+
+    bool ScanBool() {
+        const char *word_begin = pos_;
+        while (pos_ < end_ && std::isalpha(static_cast<unsigned char>(*pos_))) {
+            ++pos_;
+        }
+        return std::string_view(word_begin, pos_ - word_begin) == "true";
+    }
+
+    std::variant<int64_t, double> ScanNumber() {
+        std::variant<int64_t, double> result;
+        pos_ = ParseNumber(pos_, end_, result);
+        return result;
+    }
+
+    static std::variant<int64_t, double> ParseNumber(std::string_view text) {
+        std::variant<int64_t, double> result;
+        ParseNumber(text.data(), text.data() + text.size(), result);
+        return result;
+    }
+
+    // Parses the number at the beginning of [begin, end) and returns the position after it.
+    // Integers that fit into int64_t are stored as such, all other numbers as correctly rounded doubles.
+    // Throws std::invalid_argument unless the integer part, the fraction after '.' and the exponent
+    // after 'e' each have a digit, e.g. for "-", ".5", "1." or "1e"
+    static const char *ParseNumber(const char *begin, const char *end, std::variant<int64_t, double> &result) {
+        const bool is_negative = begin < end && *begin == '-';
+        const char *digits_begin = begin + is_negative;
+
+        // Fast path: up to 19 significant digits and a small power of ten are exact in a single
+        // multiplication or division of doubles, so its result is correctly rounded
+        uint64_t mantissa = 0;
+        const char *pos = digits_begin;
+        for (; pos < end && IsDigit(*pos); ++pos) {
+            mantissa = mantissa * 10 + (*pos - '0');
+        }
+        int digit_count = static_cast<int>(pos - digits_begin);
+        if (digit_count == 0) {
+            ThrowNoDigits(pos, end);
+        }
+        int exponent = 0;
+        bool is_integer = true;
+        if (pos < end && *pos == '.') {
+            is_integer = false;
+            const char *fraction_begin = ++pos;
+            for (; pos < end && IsDigit(*pos); ++pos) {
+                mantissa = mantissa * 10 + (*pos - '0');
+            }
+            if (pos == fraction_begin) {
+                ThrowNoDigits(pos, end);
+            }
+            exponent = -static_cast<int>(pos - fraction_begin);
+            digit_count -= exponent;
+        }
+        if (pos < end && (*pos == 'e' || *pos == 'E')) {
+            is_integer = false;
+            const bool is_exponent_negative = pos + 1 < end && pos[1] == '-';
+            pos += 1 + (pos + 1 < end && (pos[1] == '-' || pos[1] == '+'));
+            const char *exponent_begin = pos;
+            int exponent_value = 0;
+            for (; pos < end && IsDigit(*pos); ++pos) {
+                exponent_value = std::min(exponent_value * 10 + (*pos - '0'), 100000);
+            }
+            if (pos == exponent_begin) {
+                ThrowNoDigits(pos, end);
+            }
+            exponent += is_exponent_negative ? -exponent_value : exponent_value;
+        }
+
+        // 19 digits never overflow the mantissa, and only -2^63 has a magnitude beyond int64_t
+        static constexpr auto MAX_INTEGER = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+        if (is_integer && digit_count <= 19 && mantissa <= MAX_INTEGER + is_negative) {
+            result = mantissa <= MAX_INTEGER ? static_cast<int64_t>(mantissa) * (is_negative ? -1 : 1)
+                                             : std::numeric_limits<int64_t>::min();
+            return pos;
+        }
+        static constexpr double POWERS_OF_TEN[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+        };
+        if (digit_count <= 19 && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+            double value = static_cast<double>(mantissa);
+            value = exponent < 0 ? value / POWERS_OF_TEN[-exponent] : value * POWERS_OF_TEN[exponent];
+            result = is_negative ? -value : value;
+            return pos;
+        }
+
+        // libstdc++ implements it with the Eisel-Lemire algorithm and exact fallback
+        double value = 0;
+        if (std::from_chars(begin, pos, value).ec == std::errc::result_out_of_range) {
+            value = exponent < 0 ? 0.0 : std::numeric_limits<double>::infinity();
+            value = is_negative ? -value : value;
+        }
+        result = value;
+        return pos;
+    }
+
+ private:
+    const char *pos_;
+    const char *end_;
+
+    // Same set as std::isspace in the C locale: ' ' and '\t' to '\r'
+    static bool IsSpace(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static bool IsControl(char c) {
+        return static_cast<unsigned char>(c) < 0x20;
+    }
+
+    // Both scans below look at 32 (AVX2) or 16 (SSE2) bytes at a time and never read past the end,
+    // the rest is checked one character at a time
+
+    // There is no unsigned byte comparison in SSE2/AVX2, so control characters are found
+    // as the bytes that min_epu8 with 0x1F leaves unchanged
+    static const char *FindQuoteBackslashOrControl(const char *pos, const char *end) {
+#if defined(__AVX2__)
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i control_last = _mm256_set1_epi8(0x1F);
+        for (; end - pos >= 32; pos += 32) {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+            const __m256i is_control = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control_last), chunk);
+            const __m256i found = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)), is_control
+            );
+            if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(found))) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control_last = _mm_set1_epi8(0x1F);
+        for (; end - pos >= 16; pos += 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+            const __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control_last), chunk);
+            const __m128i found = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)), is_control
+            );
+            if (const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(found))) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        while (pos < end && *pos != '"' && *pos != '\\' && !IsControl(*pos)) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    static const char *SkipSpaces(const char *pos, const char *end) {
+        // Tokens are mostly separated by a single space or none at all
+        if (pos < end && !IsSpace(*pos)) {
+            return pos;
+        }
+#if defined(__AVX2__)
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i control_first = _mm256_set1_epi8('\t');
+        const __m256i control_span = _mm256_set1_epi8('\r' - '\t');
+        for (; end - pos >= 32; pos += 32) {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos));
+            const __m256i shifted = _mm256_sub_epi8(chunk, control_first);
+            const __m256i is_control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, control_span), shifted);
+            const __m256i is_space = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), is_control);
+            if (const auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(is_space))) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i control_first = _mm_set1_epi8('\t');
+        const __m128i control_span = _mm_set1_epi8('\r' - '\t');
+        for (; end - pos >= 16; pos += 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+            const __m128i shifted = _mm_sub_epi8(chunk, control_first);
+            const __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, control_span), shifted);
+            const __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(chunk, space), is_control);
+            if (const auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(is_space)) & 0xFFFFu) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        while (pos < end && IsSpace(*pos)) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    // Parses 4 hex digits, -1 if there are not enough of them
+    static int ParseHex4(const char *pos, const char *end) {
+        if (end - pos < 4) {
+            return -1;
+        }
+        int value = 0;
+        for (int idx = 0; idx < 4; ++idx) {
+            const char c = pos[idx];
+            int digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                return -1;
+            }
+            value = value * 16 + digit;
+        }
+        return value;
+    }
+
+    // pos points right after "\u". Returns the position after the consumed escape(s).
+    // Malformed escapes keep the 'u' like unknown ones, lone surrogates become U+FFFD
+    static const char *UnescapeCodePoint(const char *pos, const char *end, char *&out) {
+        const int unit = ParseHex4(pos, end);
+        if (unit < 0) {
+            *out++ = 'u';
+            return pos;
+        }
+        pos += 4;
+        uint32_t code_point = unit;
+        if (unit >= 0xD800 && unit <= 0xDBFF) {
+            const int low = end - pos >= 2 && pos[0] == '\\' && pos[1] == 'u' ? ParseHex4(pos + 2, end) : -1;
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                code_point = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                pos += 6;
+            } else {
+                code_point = 0xFFFD;
+            }
+        } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+            code_point = 0xFFFD;
+        }
+        // UTF-8 is never longer than the escape: 3 bytes for 6 characters, 4 bytes for 12
+        if (code_point < 0x80) {
+            *out++ = static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            *out++ = static_cast<char>(0xC0 | (code_point >> 6));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            *out++ = static_cast<char>(0xE0 | (code_point >> 12));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+        } else {
+            *out++ = static_cast<char>(0xF0 | (code_point >> 18));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+        return pos;
+    }
+
+    static bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // pos is where a digit of a number was expected, e.g. at 'n' of null that a parser took for a number
+    [[noreturn]] static void ThrowNoDigits(const char *pos, const char *end) {
+        throw std::invalid_argument(pos < end ? "unexpected character in JSON: " + std::string(1, *pos)
+                                              : "unexpected end of JSON");
+    }
+
+
+    static char UnescapeChar(char c) {
+        switch (c) {
+            case 'b':
+                return '\b';
+            case 'f':
+                return '\f';
+            case 'n':
+                return '\n';
+            case 'r':
+                return '\r';
+            case 't':
+                return '\t';
+            default:
+                return c;
+        }
+    }
+};
+
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "json.h"
+#include "json_scanner.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Read-only JSON DOM without per-node allocations: nodes live in a bump arena,
+// strings are views into the input and only strings with escapes are unescaped into the arena
+namespace Json::View {
+
+class Node;
+
+struct Member;
+
+class Arena {
+ public:
+    explicit Arena(size_t first_block_size = 1 << 16);
+
+    template<typename T>
+    T *Allocate(size_t count);
+
+ private:
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char *pos_ = nullptr;
+    size_t left_ = 0;
+    size_t next_block_size_;
+
+    void AddBlock(size_t min_size);
+};
+
+class Array : public Range<const Node *> {
+ public:
+    using Range::Range;
+
+    size_t size() const;
+
+    bool empty() const { return begin() == end(); }
+
+    const Node &operator[](size_t idx) const;
+
+    const Node &front() const { return *begin(); }
+
+    const Node &back() const;
+};
+
+// Members are kept in input order, lookup by key is linear and finds the first occurrence
+class Dict : public Range<const Member *> {
+ public:
+    using Range::Range;
+
+    size_t size() const;
+
+    const Node *Find(std::string_view key) const;
+
+    // Throws std::out_of_range like std::map::at
+    const Node &at(std::string_view key) const;
+
+    size_t count(std::string_view key) const { return Find(key) ? 1 : 0; }
+};
+
+class Node {
+ public:
+    bool IsArray() const { return type_ == Type::Array; }
+
+    Array AsArray() const {
+        assert(IsArray());
+        return {items_, items_ + size_};
+    }
+
+    bool IsMap() const { return type_ == Type::Dict; }
+
+    Dict AsMap() const;
+
+    bool IsBool() const { return type_ == Type::Bool; }
+
+    bool AsBool() const {
+        assert(IsBool());
+        return bool_;
+    }
+
+    bool IsInt() const { return type_ == Type::Int; }
+
+    // Unlike the other getters it checks the type even in release builds: whether a number is an integer
+    // is up to the input, and a double read as an integer would silently become a wrong one
+    int64_t AsInt() const {
+        if (!IsInt()) {
+            throw std::invalid_argument("JSON number is not an integer");
+        }
+        return int_;
+    }
+
+    bool IsPureDouble() const { return type_ == Type::Double; }
+
+    bool IsDouble() const { return IsPureDouble() || IsInt(); }
+
+    double AsDouble() const {
+        assert(IsDouble());
+        return IsPureDouble() ? double_ : static_cast<double>(int_);
+    }
+
+    bool IsString() const { return type_ == Type::String; }
+
+    std::string_view AsString() const {
+        assert(IsString());
+        return {chars_, size_};
+    }
+
+    // Copies the subtree into regular DOM for the code that works with Json::Node
+    Json::Node ToNode() const;
+
+ private:
+    friend class Parser;
+
+    enum class Type : uint8_t {
+        Array, Dict, Bool, Int, Double, String
+    };
+
+    Type type_ = Type::Int;
+    uint32_t size_ = 0;  // items, members or characters
+    union {
+        const Node *items_;
+        const Member *members_;
+        const char *chars_;
+        bool bool_;
+        int64_t int_ = 0;
+        double double_;
+    };
+};
+
+struct Member {
+    std::string_view key;
+    Node value;
+};
+
+static_assert(std::is_trivially_destructible_v<Node> && std::is_trivially_destructible_v<Member>,
+              "Arena never calls destructors");
+
+inline size_t Array::size() const { return end() - begin(); }
+
+inline const Node &Array::operator[](size_t idx) const { return begin()[idx]; }
+
+inline const Node &Array::back() const { return end()[-1]; }
+
+inline size_t Dict::size() const { return end() - begin(); }
+
+inline Dict Node::AsMap() const {
+    assert(IsMap());
+    return {members_, members_ + size_};
+}
+
+class Document {
+ public:
+    Document(Arena arena, Node root) : arena_(std::move(arena)), root_(root) {}
+
+    const Node &GetRoot() const {
+        return root_;
+    }
+
+ private:
+    Arena arena_;
+    Node root_;
+};
+
+// Input must outlive the document
+Document Load(std::string_view input);
+
+// Structural pre-pass over the array text: finds the text of each item without parsing it,
+// so that the items can be loaded independently, e.g. on different threads
+std::vector<std::string_view> SplitArray(std::string_view input);
+
+// Pull reader for the documents that are consumed piece by piece, e.g. requests answered one at a time,
+// so that only the current value is parsed. Input must outlive the reader and the documents it returns
+class Reader {
+ public:
+    explicit Reader(std::string_view input) : scanner_(input) {}
+
+    // Consumes the opening bracket of the next value, false if the value is of other type
+    bool EnterObject();
+
+    bool EnterArray();
+
+    // Consumes the key of the next member of the current object and ':' after it, nullopt after the last member
+    std::optional<std::string> NextKey();
+
+    // Whether the current array has one more item, consumes ']' after the last one
+    bool NextItem();
+
+    Document ReadValue();
+
+    // Returns the text of the skipped value, it can be loaded or read later
+    std::string_view SkipValue();
+
+ private:
+    Scanner scanner_;
+};
+
+template<typename T>
+T *Arena::Allocate(size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>);
+    const size_t size = count * sizeof(T);
+    const size_t padding = (alignof(T) - reinterpret_cast<uintptr_t>(pos_) % alignof(T)) % alignof(T);
+    if (left_ < size + padding) {
+        AddBlock(size + alignof(T));
+        return Allocate<T>(count);
+    }
+    T *result = reinterpret_cast<T *>(pos_ + padding);
+    pos_ += size + padding;
+    left_ -= size + padding;
+    return result;
+}
+
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "json.h"
+
+#include <charconv>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+namespace Json {
+
+// Serializes JSON into a growable buffer and passes it to the stream in large blocks.
+// With DoubleFormat::Compatible the output is byte-identical to PrintValue/PrintNode.
+// Objects and arrays can be written either from Json::Node trees or field by field:
+// BeginObject, Key and value, ..., EndObject; separators are inserted automatically
+class Writer {
+ public:
+    enum class DoubleFormat {
+        Compatible,  // like ostream operator<<, i.e. %g with precision significant digits
+        Shortest,    // shortest representation that reads back to the same double
+        Fixed,       // precision digits after the decimal point
+    };
+
+    explicit Writer(std::ostream &output, DoubleFormat double_format = DoubleFormat::Compatible, int precision = 6);
+
+    Writer(const Writer &) = delete;
+
+    Writer &operator=(const Writer &) = delete;
+
+    ~Writer();
+
+    void BeginObject();
+
+    void Key(std::string_view key);
+
+    void EndObject();
+
+    void BeginArray();
+
+    void EndArray();
+
+    void Write(const Node &node);
+
+    void Write(const Array &nodes);
+
+    void Write(const Dict &dict);
+
+    // Quoted and escaped
+    void Write(std::string_view value);
+
+    void Write(const std::string &value) { Write(std::string_view(value)); }
+
+    void Write(const char *value) { Write(std::string_view(value)); }
+
+    void Write(bool value);
+
+    void Write(int value);
+
+    // For counters that don't fit into int
+    void Write(int64_t value);
+
+    void Write(double value);
+
+    // Writes a string value produced by render(std::ostream &), e.g. an SVG document,
+    // escaping it on the fly instead of rendering into a temporary string first
+    template<typename RenderFunc>
+    void WriteString(RenderFunc render);
+
+    // Appended as is, e.g. already serialized JSON
+    void WriteRaw(std::string_view text);
+
+    // Already serialized value, separated from the previous one like any other value
+    void WriteSerialized(std::string_view value);
+
+    void WriteRaw(char c);
+
+    void Flush();
+
+    // Bytes written so far, including the ones not flushed to the stream yet
+    size_t GetSize() const { return flushed_size_ + buffer_.size(); }
+
+ private:
+    static constexpr size_t FLUSH_THRESHOLD = 1 << 16;
+    static constexpr int MAX_DEPTH = 64;
+
+    // Collects rendered text in a small put area and escapes it into the writer when the area is full
+    class EscapingBuffer : public std::streambuf {
+     public:
+        explicit EscapingBuffer(Writer &writer);
+
+     protected:
+        int_type overflow(int_type c) override;
+
+        int sync() override;
+
+     private:
+        Writer &writer_;
+        char chars_[1024];
+
+        void Drain();
+    };
+
+    std::ostream &output_;
+    DoubleFormat double_format_;
+    int precision_;
+    std::string buffer_;
+    size_t flushed_size_ = 0;
+
+    // Bit per nesting level, so that no allocations are needed to track it
+    int depth_ = 0;
+    uint64_t in_array_ = 0;
+    uint64_t has_items_ = 0;
+
+    void BeginValue();
+
+    void BeginScope(char bracket, bool is_array);
+
+    void EndScope(char bracket);
+
+    void AppendEscaped(std::string_view value);
+
+    void FlushIfFull();
+
+    std::to_chars_result FormatDouble(double value, char *first, char *last) const;
+};
+
+template<typename RenderFunc>
+void Writer::WriteString(RenderFunc render) {
+    BeginValue();
+    buffer_ += '"';
+    EscapingBuffer escaping_buffer(*this);
+    std::ostream escaping_stream(&escaping_buffer);
+    render(escaping_stream);
+    escaping_buffer.pubsync();
+    buffer_ += '"';
+    FlushIfFull();
+}
+
+}
@@ -2,12 +2,15 @@
 
 #include "descriptions.h"
 #include "json.h"
+#include "name_index.h"
 #include "svg.h"
 #include "transport_router.h"
 
 #include "map_renderer.pb.h"
 
-#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -34,15 +37,21 @@ struct RenderSettings {
     static RenderSettings Deserialize(const TCProto::RenderSettings &proto);
 };
 
+// Keeps stops and buses by ids, the names are looked up in the indices of the catalog only for labels
 class MapRenderer {
  public:
     MapRenderer(const Descriptions::StopsDict &stops_dict,
                 const Descriptions::BusesDict &buses_dict,
+                std::shared_ptr<const NameIndex> stops,
+                std::shared_ptr<const NameIndex> buses,
                 const Json::Dict &render_settings_json);
 
     void Serialize(TCProto::MapRenderer &proto);
 
-    static std::unique_ptr<MapRenderer> Deserialize(const TCProto::MapRenderer &proto);
+    // Names of the base must be in the indices, std::out_of_range is thrown otherwise
+    static std::unique_ptr<MapRenderer> Deserialize(const TCProto::MapRenderer &proto,
+                                                    std::shared_ptr<const NameIndex> stops,
+                                                    std::shared_ptr<const NameIndex> buses);
 
     const Svg::Document& Render() const;
 
@@ -51,18 +60,25 @@ class MapRenderer {
     MapRenderer() = default;
 
  private:
+    struct BusRoute {
+        std::vector<StopId> stops;
+        std::vector<StopId> endpoints;
+    };
+
     RenderSettings render_settings_;
-    std::map<std::string, Svg::Point> stops_coords_;
-    std::unordered_map<std::string, Svg::Color> bus_colors_;
-    // TODO: move instead of copy
-    std::map<std::string, Descriptions::Bus> buses_dict_;
+    std::shared_ptr<const NameIndex> stops_;
+    std::shared_ptr<const NameIndex> buses_;
+    std::vector<Svg::Point> stops_coords_;  // by StopId
+    std::vector<Svg::Color> bus_colors_;    // by BusId
+    std::vector<BusRoute> bus_routes_;      // by BusId
     mutable std::optional<Svg::Document> whole_map_;
+    mutable std::once_flag whole_map_once_;  // the map may be requested from several threads at once
 
-    void RenderBusLabel(Svg::Document &svg, const std::string &bus_name, const std::string &stop_name) const;
+    void RenderBusLabel(Svg::Document &svg, BusId bus_id, StopId stop_id) const;
 
     void RenderStopPoint(Svg::Document &svg, Svg::Point point) const;
 
-    void RenderStopLabel(Svg::Document &svg, Svg::Point point, const std::string &name) const;
+    void RenderStopLabel(Svg::Document &svg, StopId stop_id) const;
 
     void RenderBusLines(Svg::Document &svg) const;
 
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+ public:
+    // Throws std::system_error if the file can't be opened or mapped
+    explicit MappedFile(const std::string &file_name);
+
+    // Maps the file open as fd, e.g. while it is locked, and leaves the descriptor open.
+    // file_name is only for the error messages
+    MappedFile(int fd, const std::string &file_name);
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept;
+
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    ~MappedFile();
+
+    std::string_view GetData() const;
+
+    // In nanoseconds since the epoch, as of mapping
+    int64_t GetModificationTime() const {
+        return modification_time_ns_;
+    }
+
+ private:
+    void *data_ = nullptr;
+    size_t size_ = 0;
+    int64_t modification_time_ns_ = 0;
+
+    void Map(int fd, const std::string &file_name);
+};
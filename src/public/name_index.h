@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using StopId = uint32_t;
+using BusId = uint32_t;
+
+// Dense ids of stop or bus names: 0, 1, ... in alphabetical order of the names, the order the map draws them in.
+// The catalog keeps one index of stops and one of buses, its parts keep ids and find names here.
+// Not copyable or movable, keys of the hash table point into the names, so it is shared by pointer
+class NameIndex {
+ public:
+    explicit NameIndex(std::vector<std::string> names);
+
+    NameIndex(const NameIndex &) = delete;
+
+    NameIndex &operator=(const NameIndex &) = delete;
+
+    std::optional<uint32_t> Find(std::string_view name) const;
+
+    // Throws std::out_of_range if there is no such name
+    uint32_t At(std::string_view name) const;
+
+    const std::string &GetName(uint32_t id) const {
+        return names_[id];
+    }
+
+    size_t GetCount() const {
+        return names_.size();
+    }
+
+ private:
+    std::vector<std::string> names_;
+    std::unordered_map<std::string_view, uint32_t> ids_;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <google/protobuf/message_lite.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ProtoSections {
+
+struct Field {
+    int number;
+    std::string_view bytes;    // whole field: tag, length and payload
+    std::string_view payload;  // only for length-delimited fields
+};
+
+// Splits serialized message into its top-level fields without parsing them.
+// Throws std::runtime_error if the message is truncated or malformed
+std::vector<Field> Split(std::string_view message);
+
+// Payloads of the fields with the given number, in the order they were serialized
+std::vector<std::string_view> CollectPayloads(const std::vector<Field> &fields, int number);
+
+// Appends length-delimited field, so separately encoded parts can be concatenated into one message
+void AppendField(std::string &message, int number, std::string_view payload);
+
+void AppendField(std::string &message, int number, const google::protobuf::MessageLite &payload);
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Counters of the requests answered by this process, always on. Each thread records into a slot of its own
+// with plain loads and stores, no locks or read-modify-write instructions; the slots are summed up when read
+namespace Requests::Metrics {
+
+// Log-linear buckets like HdrHistogram: values below 2^SUB_BUCKET_BITS have a bucket each, bigger ones
+// fall into buckets no wider than 1/2^SUB_BUCKET_BITS of their values, so quantiles are within about 3%
+struct Histogram {
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int MAX_VALUE_BITS = 36;  // bigger values, e.g. over a minute in ns, share the last bucket
+    static constexpr size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    static size_t GetBucketIdx(uint64_t value);
+
+    // Highest value that falls into the bucket
+    static uint64_t GetBucketValue(size_t bucket_idx);
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKET_COUNT);
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    uint64_t GetCount() const;
+
+    double GetMean() const;
+
+    // Highest value of the bucket holding the quantile, but not above max; 0 if empty
+    uint64_t GetValueAtQuantile(double quantile) const;
+};
+
+// Requests are recorded by the index of their type, the caller knows the names
+constexpr size_t MAX_TYPE_COUNT = 8;
+
+struct TypeStats {
+    uint64_t bytes = 0;       // of the responses
+    uint64_t cache_hits = 0;  // answered from the response cache
+    Histogram latency_ns;
+};
+
+struct Snapshot {
+    std::array<TypeStats, MAX_TYPE_COUNT> types;
+    Histogram route_items;  // per found route
+};
+
+void RecordRequest(size_t type_idx, std::chrono::steady_clock::duration latency, size_t byte_count);
+
+void RecordCacheHit(size_t type_idx);
+
+void RecordRouteItems(size_t item_count);
+
+// Sum over all threads, requests being answered meanwhile may be partly counted
+Snapshot TakeSnapshot();
+
+}
@@ -1,37 +1,126 @@
 #pragma once
 
+#include "disk_response_cache.h"
 #include "json.h"
+#include "json_view.h"
+#include "json_writer.h"
+#include "response_cache.h"
 #include "transport_catalog.h"
+#include "utils.h"
 
+#include "requests.pb.h"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
 #include <string>
 #include <variant>
 
 
+// Each request writes its response object straight into the writer. Keys go in alphabetical order,
+// request_id included, the same as std::map based Json::Dict printed them.
+// Binary protocol responses are filled in the same way, request_id is set by the caller.
+// Requests with equal GetCacheKey have equal responses but for the request_id
 namespace Requests {
 struct Stop {
     std::string name;
 
-    Json::Dict Process(const TransportCatalog &db) const;
+    std::string GetCacheKey() const;
+
+    void Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const;
+
+    void Process(const TransportCatalog &db, TCProto::StatResponse &response) const;
 };
 
 struct Bus {
     std::string name;
 
-    Json::Dict Process(const TransportCatalog &db) const;
+    std::string GetCacheKey() const;
+
+    void Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const;
+
+    void Process(const TransportCatalog &db, TCProto::StatResponse &response) const;
+};
+
+// What a Route response carries instead of the rendered route, most clients need only the items
+enum class RouteMapMode {
+    Inline,    // "map": the SVG document
+    Omit,      // nothing
+    Deferred,  // "map_handle": RouteMap request with it is answered with the map
 };
 
 struct Route {
     std::string stop_from;
     std::string stop_to;
+    RouteMapMode map_mode = RouteMapMode::Inline;
 
-    Json::Dict Process(const TransportCatalog &db) const;
+    std::string GetCacheKey() const;
+
+    void Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const;
+
+    void Process(const TransportCatalog &db, TCProto::StatResponse &response) const;
 };
 
 struct Map {
-    Json::Dict Process(const TransportCatalog &db) const;
+    std::string GetCacheKey() const;
+
+    void Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const;
+
+    void Process(const TransportCatalog &db, TCProto::StatResponse &response) const;
 };
 
-std::variant<Stop, Bus, Route, Map> Read(const Json::Dict &attrs);
+// Map of a route answered with RouteMapMode::Deferred. The handle holds the stops themselves,
+// so it is valid for any process serving the base, but after a reload the route is found in the new base
+struct RouteMap {
+    std::string handle;
+
+    std::string GetCacheKey() const;
+
+    void Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const;
+
+    void Process(const TransportCatalog &db, TCProto::StatResponse &response) const;
+};
+
+// Latency and size of the responses by request type, response cache hits and items of found routes,
+// counted over all requests answered by this process so far. Never cached, the answer changes with each request
+struct Stats {
+    void Process(const TransportCatalog &db, int64_t request_id, Json::Writer &writer) const;
+
+    void Process(const TransportCatalog &db, TCProto::StatResponse &response) const;
+};
+
+using Request = std::variant<Stop, Bus, Route, Map, RouteMap, Stats>;
+
+Request Read(const Json::Dict &attrs);
+
+Request Read(const Json::View::Dict &attrs);
+
+Request Read(const TCProto::StatRequest &request);
+
+// Encodes the responses to Stop and Bus requests for all stops and buses of the catalog and stores them in it,
+// they are answered by copying then
+void EncodeResponses(TransportCatalog &db);
+
+// With a pool requests are answered on its threads, responses are still printed in request order.
+// With a cache Stop, Bus, Route and Map responses are taken from it or put into it, it must be filled from db only.
+// The same goes for a disk cache, which is looked into after the cache
+void ProcessAll(const TransportCatalog &db, const Json::Array &requests, std::ostream &output,
+                ThreadPool *pool = nullptr, ResponseCache *cache = nullptr, DiskResponseCache *disk_cache = nullptr);
+
+void ProcessAll(const TransportCatalog &db, const Json::View::Array &requests, std::ostream &output,
+                ThreadPool *pool = nullptr, ResponseCache *cache = nullptr, DiskResponseCache *disk_cache = nullptr);
+
+// Reads the requests array one request at a time and prints each response as soon as it is ready,
+// so memory doesn't grow with the number of requests. Output is the same as ProcessAll one.
+// With a pool only a small window of requests per thread is read ahead
+void ProcessStream(const TransportCatalog &db, Json::View::Reader &requests, std::ostream &output,
+                   ThreadPool *pool = nullptr, ResponseCache *cache = nullptr, DiskResponseCache *disk_cache = nullptr);
+
+// Binary protocol: reads length-delimited TCProto::StatRequest messages until the end of input and
+// writes a length-delimited TCProto::StatResponse for each of them as it goes.
+// Throws std::runtime_error if the input ends in the middle of a message or a message is malformed
+void ProcessBinaryStream(const TransportCatalog &db, std::istream &input, std::ostream &output);
 
-Json::Array ProcessAll(const TransportCatalog &db, const Json::Array &requests);
+// Prints what a Stats request is answered with in a human readable form, types without requests are skipped
+void PrintStats(std::ostream &output);
 }
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Requests {
+
+// Bounded LRU of encoded JSON responses keyed by the request without its id, e.g. a Route by its stops.
+// The response is kept as text with the request_id digits cut out, so a hit is answered by copying it
+// around the new id. Safe to use from several threads: entries are split between shards with a lock each.
+// Responses depend on the base, so the cache must not outlive the catalog it was filled from
+class ResponseCache {
+ public:
+    struct Response {
+        std::string text;        // without the request_id value
+        size_t request_id_pos;   // where the request_id value goes
+    };
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t entry_count = 0;
+        size_t size_bytes = 0;
+    };
+
+    // Least recently used responses are dropped once their text takes more than max_size_bytes,
+    // responses bigger than a shard share of it are not kept at all
+    explicit ResponseCache(size_t max_size_bytes);
+
+    // Counts a hit or a miss, nullptr on a miss
+    std::shared_ptr<const Response> Find(std::string_view key);
+
+    void Insert(std::string key, std::shared_ptr<const Response> response);
+
+    Stats GetStats() const;
+
+ private:
+    static constexpr size_t SHARD_COUNT = 16;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        // Most recently used first, index keys point into the list keys
+        std::list<std::pair<std::string, std::shared_ptr<const Response>>> entries;
+        std::unordered_map<std::string_view, decltype(entries)::iterator> index;
+        size_t size_bytes = 0;
+    };
+
+    size_t max_shard_size_bytes_;
+    std::vector<Shard> shards_;
+    std::atomic<size_t> hits_ = 0;
+    std::atomic<size_t> misses_ = 0;
+
+    Shard &GetShard(std::string_view key);
+};
+
+}
@@ -2,14 +2,19 @@
 
 #include "graph.h"
 #include "graph.pb.h"
+#include "proto_sections.h"
+#include "utils.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <optional>
-#include <unordered_map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <utility>
 #include <type_traits>
 #include <vector>
@@ -22,40 +27,54 @@ class Router {
     using Graph = DirectedWeightedGraph<Weight>;
 
  public:
-    Router(const Graph &graph);
+    // Lets an updated graph take routes of unchanged components from the router of the previous graph
+    struct PreviousRoutes {
+        const Router &router;
+        // Vertices of the previous graph matching the vertices of the component one by one,
+        // nullopt if the component has changed and must be recomputed
+        std::function<std::optional<std::vector<VertexId>>(const std::vector<VertexId> &component)> map_component;
+        // Id of the previous graph edge in the current graph
+        std::function<EdgeId(EdgeId)> map_edge;
+    };
+
+    Router(const Graph &graph, const PreviousRoutes *previous = nullptr);
 
     void Serialize(GraphProto::Router &proto);
 
+    // Encodes serialized GraphProto::Router, rows are encoded in parallel chunks
+    std::string Serialize() const;
+
     static std::unique_ptr<Router> Deserialize(const GraphProto::Router &proto, const Graph &graph);
 
-    using RouteId = uint64_t;
+    // Takes serialized GraphProto::RoutesInternalDataByTarget rows and decodes them in parallel chunks
+    static std::unique_ptr<Router> Deserialize(const std::vector<std::string_view> &sources_data, const Graph &graph);
 
-    struct RouteInfo {
-        RouteId id;
+    struct ExpandedRouteInfo {
         Weight weight;
-        size_t edge_count;
+        std::vector<EdgeId> edges;
     };
 
-    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
-
-    EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
-
-    void ReleaseRoute(RouteId route_id);
+    // Edges of the shortest route in order, nullopt if to can't be reached from from.
+    // Returned by value, so nothing is kept in the router and routes can be expanded from several threads at once
+    std::optional<ExpandedRouteInfo> ExpandRoute(VertexId from, VertexId to) const;
 
  private:
     Router(const Graph &graph, const GraphProto::Router &proto);
 
+    Router(const Graph &graph, const std::vector<std::string_view> &sources_data);
+
     const Graph &graph_;
 
     struct RouteInternalData {
         Weight weight;
         std::optional<EdgeId> prev_edge;
     };
-    using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+    using SourceInternalData = std::vector<std::optional<RouteInternalData>>;
+    using RoutesInternalData = std::vector<SourceInternalData>;
+
+    static void SerializeSourceData(const SourceInternalData &data, GraphProto::RoutesInternalDataByTarget &proto);
 
-    using ExpandedRoute = std::vector<EdgeId>;
-    mutable RouteId next_route_id_ = 0;
-    mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+    static void DeserializeSourceData(const GraphProto::RoutesInternalDataByTarget &proto, SourceInternalData &data);
 
     void InitializeRoutesInternalData(const Graph &graph) {
         const size_t vertex_count = graph.GetVertexCount();
@@ -86,10 +105,11 @@ class Router {
         }
     }
 
-    void RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through) {
-        for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
+    // There are no routes between components, so relaxing inside the component is enough
+    void RelaxRoutesInternalDataThroughVertex(const std::vector<VertexId> &component, VertexId vertex_through) {
+        for (const VertexId vertex_from : component) {
             if (const auto &route_from = routes_internal_data_[vertex_from][vertex_through]) {
-                for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
+                for (const VertexId vertex_to : component) {
                     if (const auto &route_to = routes_internal_data_[vertex_through][vertex_to]) {
                         RelaxRoute(vertex_from, vertex_to, *route_from, *route_to);
                     }
@@ -98,38 +118,103 @@ class Router {
         }
     }
 
+    void CopyComponentRoutes(const std::vector<VertexId> &component,
+                             const std::vector<VertexId> &previous_component,
+                             const PreviousRoutes &previous) {
+        for (size_t from_idx = 0; from_idx < component.size(); ++from_idx) {
+            const auto &previous_source_data = previous.router.routes_internal_data_[previous_component[from_idx]];
+            auto &source_data = routes_internal_data_[component[from_idx]];
+            for (size_t to_idx = 0; to_idx < component.size(); ++to_idx) {
+                auto &route_data = source_data[component[to_idx]] = previous_source_data[previous_component[to_idx]];
+                if (route_data && route_data->prev_edge) {
+                    route_data->prev_edge = previous.map_edge(*route_data->prev_edge);
+                }
+            }
+        }
+    }
+
     RoutesInternalData routes_internal_data_;
 };
 
 
 template<typename Weight>
-Router<Weight>::Router(const Graph &graph)
+Router<Weight>::Router(const Graph &graph, const PreviousRoutes *previous)
     : graph_(graph),
       routes_internal_data_(graph.GetVertexCount(),
                             std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount())) {
     InitializeRoutesInternalData(graph);
 
-    const size_t vertex_count = graph.GetVertexCount();
-    for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
-        RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
+    for (const auto &component : ComputeWeakComponents(graph)) {
+        if (previous) {
+            if (const auto previous_component = previous->map_component(component)) {
+                CopyComponentRoutes(component, *previous_component, *previous);
+                continue;
+            }
+        }
+        for (const VertexId vertex_through : component) {
+            RelaxRoutesInternalDataThroughVertex(component, vertex_through);
+        }
     }
 }
 
 template<typename Weight>
-void Router<Weight>::Serialize(GraphProto::Router &proto) {
+void Router<Weight>::SerializeSourceData(const SourceInternalData &data,
+                                         GraphProto::RoutesInternalDataByTarget &proto) {
     static_assert(std::is_same_v<Weight, double>, "Serialization is implemented only for double weights");
 
+    for (const auto &route_data : data) {
+        auto &route_data_proto = *proto.add_targets_data();
+        if (route_data) {
+            route_data_proto.set_exists(true);
+            route_data_proto.set_weight(route_data->weight);
+            if (route_data->prev_edge) {
+                route_data_proto.set_has_prev_edge(true);
+                route_data_proto.set_prev_edge(*route_data->prev_edge);
+            }
+        }
+    }
+}
+
+template<typename Weight>
+void Router<Weight>::Serialize(GraphProto::Router &proto) {
     for (const auto &source_data : routes_internal_data_) {
-        auto &source_data_proto = *proto.add_sources_data();
-        for (const auto &route_data : source_data) {
-            auto &route_data_proto = *source_data_proto.add_targets_data();
-            if (route_data) {
-                route_data_proto.set_exists(true);
-                route_data_proto.set_weight(route_data->weight);
-                if (route_data->prev_edge) {
-                    route_data_proto.set_has_prev_edge(true);
-                    route_data_proto.set_prev_edge(*route_data->prev_edge);
-                }
+        SerializeSourceData(source_data, *proto.add_sources_data());
+    }
+}
+
+template<typename Weight>
+std::string Router<Weight>::Serialize() const {
+    const size_t vertex_count = routes_internal_data_.size();
+    const auto chunks = TransformChunksParallel(vertex_count, GetWorkerCount(), [this](size_t begin, size_t end) {
+        std::string chunk;
+        GraphProto::RoutesInternalDataByTarget source_data_proto;
+        for (VertexId vertex = begin; vertex < end; ++vertex) {
+            source_data_proto.Clear();
+            SerializeSourceData(routes_internal_data_[vertex], source_data_proto);
+            ProtoSections::AppendField(chunk, GraphProto::Router::kSourcesDataFieldNumber, source_data_proto);
+        }
+        return chunk;
+    });
+
+    std::string result;
+    for (const std::string &chunk : chunks) {
+        result += chunk;
+    }
+    return result;
+}
+
+template<typename Weight>
+void Router<Weight>::DeserializeSourceData(const GraphProto::RoutesInternalDataByTarget &proto,
+                                           SourceInternalData &data) {
+    static_assert(std::is_same_v<Weight, double>, "Serialization is implemented only for double weights");
+
+    data.reserve(proto.targets_data_size());
+    for (const auto &route_data_proto : proto.targets_data()) {
+        auto &route_data = data.emplace_back();
+        if (route_data_proto.exists()) {
+            route_data = RouteInternalData{route_data_proto.weight(), std::nullopt};
+            if (route_data_proto.has_prev_edge()) {
+                route_data->prev_edge = route_data_proto.prev_edge();
             }
         }
     }
@@ -138,22 +223,26 @@ void Router<Weight>::Serialize(GraphProto::Router &proto) {
 template<typename Weight>
 Router<Weight>::Router(const Graph &graph, const GraphProto::Router &proto)
     : graph_(graph) {
-    static_assert(std::is_same_v<Weight, double>, "Serialization is implemented only for double weights");
-
     routes_internal_data_.reserve(proto.sources_data_size());
     for (const auto &source_data_proto : proto.sources_data()) {
-        auto &source_data = routes_internal_data_.emplace_back();
-        source_data.reserve(source_data_proto.targets_data_size());
-        for (const auto &route_data_proto : source_data_proto.targets_data()) {
-            auto &route_data = source_data.emplace_back();
-            if (route_data_proto.exists()) {
-                route_data = RouteInternalData{route_data_proto.weight(), std::nullopt};
-                if (route_data_proto.has_prev_edge()) {
-                    route_data->prev_edge = route_data_proto.prev_edge();
-                }
+        DeserializeSourceData(source_data_proto, routes_internal_data_.emplace_back());
+    }
+}
+
+template<typename Weight>
+Router<Weight>::Router(const Graph &graph, const std::vector<std::string_view> &sources_data)
+    : graph_(graph),
+      routes_internal_data_(sources_data.size()) {
+    ForEachChunkParallel(sources_data.size(), GetWorkerCount(), [&](size_t begin, size_t end) {
+        GraphProto::RoutesInternalDataByTarget source_data_proto;
+        for (size_t vertex = begin; vertex < end; ++vertex) {
+            if (!source_data_proto.ParseFromArray(sources_data[vertex].data(),
+                                                  static_cast<int>(sources_data[vertex].size()))) {
+                throw std::runtime_error("malformed base section");
             }
+            DeserializeSourceData(source_data_proto, routes_internal_data_[vertex]);
         }
-    }
+    });
 }
 
 template<typename Weight>
@@ -162,34 +251,26 @@ std::unique_ptr<Router<Weight>> Router<Weight>::Deserialize(const GraphProto::Ro
 }
 
 template<typename Weight>
-std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to) const {
-    const auto &route_internal_data = routes_internal_data_[from][to];
+std::unique_ptr<Router<Weight>> Router<Weight>::Deserialize(const std::vector<std::string_view> &sources_data,
+                                                            const Graph &graph) {
+    return std::unique_ptr<Router>(new Router(graph, sources_data));
+}
+
+template<typename Weight>
+std::optional<typename Router<Weight>::ExpandedRouteInfo> Router<Weight>::ExpandRoute(VertexId from, VertexId to) const {
+    const SourceInternalData &source_data = routes_internal_data_[from];
+    const auto &route_internal_data = source_data[to];
     if (!route_internal_data) {
         return std::nullopt;
     }
-    const Weight weight = route_internal_data->weight;
-    std::vector<EdgeId> edges;
+    ExpandedRouteInfo route{route_internal_data->weight, {}};
     for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
          edge_id;
-         edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
-        edges.push_back(*edge_id);
+         edge_id = source_data[graph_.GetEdge(*edge_id).from]->prev_edge) {
+        route.edges.push_back(*edge_id);
     }
-    std::reverse(std::begin(edges), std::end(edges));
-
-    const RouteId route_id = next_route_id_++;
-    const size_t route_edge_count = edges.size();
-    expanded_routes_cache_[route_id] = std::move(edges);
-    return RouteInfo{route_id, weight, route_edge_count};
-}
-
-template<typename Weight>
-EdgeId Router<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
-    return expanded_routes_cache_.at(route_id)[edge_idx];
-}
-
-template<typename Weight>
-void Router<Weight>::ReleaseRoute(RouteId route_id) {
-    expanded_routes_cache_.erase(route_id);
+    std::reverse(std::begin(route.edges), std::end(route.edges));
+    return route;
 }
 
 }
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "transport_catalog.h"
+#include "utils.h"
+
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace Server {
+
+// Long-running mode: the base is loaded once and then request documents are answered one per line.
+// A line holds either a whole document like {"stat_requests": [...]} or just the array of requests
+// and is answered with one line holding the array of responses.
+// Line {"control": "reload"} loads the base again in the background, see Reload,
+// line {"control": "memory"} is answered with the memory usage of the answering process,
+// line {"control": "cache"} with the counters of its response cache
+class RequestServer {
+ public:
+    using BaseLoader = std::function<std::shared_ptr<const TransportCatalog>()>;
+
+    // Loads the first base right away, load_base is called again on each reload.
+    // With cache_size_bytes > 0 responses are cached, each base has a Requests::ResponseCache of its own
+    RequestServer(BaseLoader load_base, size_t thread_count, size_t cache_size_bytes = 0);
+
+    RequestServer(const RequestServer &) = delete;
+
+    RequestServer &operator=(const RequestServer &) = delete;
+
+    ~RequestServer();
+
+    // Appends the answer and '\n' to output. Errors in the document are answered with
+    // {"error_message": ...} instead, so that one bad document doesn't stop the server
+    void ProcessLine(std::string_view line, std::string &output);
+
+    // Answers lines until the end of input, blank lines are skipped
+    void Serve(std::istream &input, std::ostream &output);
+
+    // Listens on the Unix domain socket and answers the lines of each client over its connection.
+    // All clients are served by one thread with epoll. Returns only by exception,
+    // throws std::system_error if the socket can't be set up
+    void ServeSocket(const std::string &socket_path);
+
+    // Pre-forked mode for many cores: this process loads the base and forks worker_count workers that share it
+    // copy-on-write, each of them serves clients of the socket like ServeSocket does. Signals to this process:
+    // SIGHUP loads the base again and replaces the workers, the old ones answer the lines they have
+    // already received and exit; SIGUSR1 prints memory usage of each process to stderr;
+    // SIGTERM or SIGINT stops the workers the same way and returns. Dead workers are restarted.
+    // Must be called before any other threads are started
+    void ServeWorkers(const std::string &socket_path, size_t worker_count);
+
+    // Starts loading the base on a background thread, false if a reload is already running.
+    // Requests keep being answered from the current base meanwhile. The new base is published atomically:
+    // each document is answered from one base, documents taken before the switch finish on the old one
+    // and the old one is destroyed on the background thread once they are done.
+    // If loading fails the current base stays and the error is printed to stderr
+    bool Reload();
+
+    // Calls Reload whenever the process gets signal_number, e.g. SIGHUP. Must be called before
+    // any other threads are started, since the signal is blocked for all threads but the waiting one.
+    // Not for ServeWorkers, it handles signals itself
+    void ReloadOnSignal(int signal_number);
+
+ private:
+    struct Base;
+
+    BaseLoader load_base_;
+    size_t thread_count_;
+    size_t cache_size_bytes_;
+    std::shared_ptr<Base> base_;  // only through std::atomic_load and friends
+
+    std::once_flag pool_once_;
+    std::unique_ptr<ThreadPool> pool_;  // see GetPool
+
+    std::mutex reload_mutex_;
+    std::thread reload_thread_;
+    std::atomic<bool> is_reloading_ = false;
+
+    int reload_signal_ = 0;
+    std::thread signal_thread_;
+    std::atomic<bool> is_stopping_ = false;
+
+    int parent_pid_ = 0;  // set in workers of ServeWorkers, they ask the parent to reload
+
+    struct Connection;
+
+    // Stops accepting once stop_fd, if any, becomes readable, and returns after answering the lines
+    // that are already received
+    void ServeConnections(int listener_fd, int stop_fd = -1);
+
+    [[noreturn]] void RunWorker(int listener_fd);
+
+    int StartWorker(int listener_fd);
+
+    // Answers the next complete line of the connection input, false if there is none
+    bool AnswerNextLine(Connection &connection);
+
+    void ProcessControl(std::string_view command, std::ostream &output);
+
+    std::shared_ptr<Base> LoadBase();
+
+    // Threads that answer the requests of every line, nullptr for one thread. Started by the first line
+    // rather than by the constructor, since ServeWorkers forks after it
+    ThreadPool *GetPool();
+
+    void LoadInBackground();
+};
+
+}
@@ -28,6 +28,8 @@ struct Rgba : Rgb {
 using Color = std::variant<std::monostate, std::string, Rgb, Rgba>;
 const Color NoneColor{};
 
+void RenderColor(std::ostream &out, const Color &color);
+
 class Object {
  public:
     virtual std::unique_ptr<Object> Copy() const = 0;
@@ -3,20 +3,25 @@
 #include "descriptions.h"
 #include "json.h"
 #include "map_renderer.h"
+#include "name_index.h"
 #include "svg.h"
 #include "transport_router.h"
 #include "utils.h"
 
+#include "transport_catalog.pb.h"
+
+#include <functional>
+#include <memory>
 #include <optional>
-#include <set>
+#include <ostream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 namespace Responses {
 struct Stop {
-    std::set<std::string> bus_names;
+    std::vector<BusId> bus_ids;  // sorted, so the buses go by their names
 };
 
 struct Bus {
@@ -25,33 +30,85 @@ struct Bus {
     size_t road_route_length = 0;
     double geo_route_length = 0.0;
 };
+
+// Response already encoded by the request layer, with the request_id value cut out at request_id_pos
+struct Encoded {
+    std::string text;
+    size_t request_id_pos = 0;
+};
 }
 
+// Stops and buses are kept by dense ids, see NameIndex. Names are resolved to ids once, when a request comes
 class TransportCatalog {
  private:
     using Bus = Responses::Bus;
     using Stop = Responses::Stop;
 
  public:
+    // With previous base, stats of unchanged buses and routes of unchanged components are taken from it
     TransportCatalog(
         std::vector<Descriptions::InputQuery> data,
         const Json::Dict &routing_settings_json,
-        const Json::Dict &render_settings_json
+        const Json::Dict &render_settings_json,
+        const TransportCatalog *previous = nullptr
     );
 
-    const Stop *GetStop(const std::string &name) const;
+    std::optional<StopId> FindStop(std::string_view name) const;
+
+    std::optional<BusId> FindBus(std::string_view name) const;
+
+    const Stop &GetStop(StopId stop_id) const {
+        return stops_[stop_id];
+    }
+
+    const Bus &GetBus(BusId bus_id) const {
+        return buses_[bus_id];
+    }
+
+    const std::string &GetStopName(StopId stop_id) const {
+        return stops_index_->GetName(stop_id);
+    }
+
+    const std::string &GetBusName(BusId bus_id) const {
+        return buses_index_->GetName(bus_id);
+    }
+
+    // Stop and Bus responses stored in the base, see EncodeResponses; nullptr if the base has none
+    const Responses::Encoded *GetEncodedStop(StopId stop_id) const;
+
+    const Responses::Encoded *GetEncodedBus(BusId bus_id) const;
+
+    using ResponseEncoder = std::function<Responses::Encoded(const std::string &name)>;
 
-    const Bus *GetBus(const std::string &name) const;
+    // Keeps the responses the encoders give for each stop and each bus name, e.g. Requests::EncodeResponses does it.
+    // The catalog doesn't look into them, they are only stored in the base and given back by GetEncodedStop/Bus
+    void EncodeResponses(const ResponseEncoder &encode_stop, const ResponseEncoder &encode_bus);
 
-    std::optional<TransportRouter::RouteInfo> FindRoute(const std::string &stop_from, const std::string &stop_to) const;
+    // Throws std::out_of_range if there is no such stop
+    std::optional<TransportRouter::RouteInfo> FindRoute(std::string_view stop_from, std::string_view stop_to) const;
 
-    std::string RenderMap() const;
+    std::optional<TransportRouter::RouteInfo> FindRoute(StopId stop_from, StopId stop_to) const {
+        return router_->FindRoute(stop_from, stop_to);
+    }
 
-    std::string RenderRoute(const TransportRouter::RouteInfo &route) const;
+    void RenderMap(std::ostream &out) const;
+
+    void RenderRoute(const TransportRouter::RouteInfo &route, std::ostream &out) const;
+
+    // Builds what is otherwise built by the first request that needs it, e.g. the whole map,
+    // so that processes forked afterwards share it instead of building their own copies
+    void WarmUp() const;
 
     std::string Serialize() const;
 
-    static TransportCatalog Deserialize(const std::string &data);
+    // Encodes sections and chunks of repeated fields concurrently into separate buffers and concatenates them
+    std::string Serialize(SectionTimings &timings) const;
+
+    static TransportCatalog Deserialize(std::string_view data);
+
+    // Splits serialized base into sections and decodes them concurrently.
+    // Input descriptions are needed only to update the base, so they are skipped
+    static TransportCatalog Deserialize(std::string_view data, SectionTimings &timings);
 
  private:
     TransportCatalog() = default;
@@ -66,10 +123,35 @@ class TransportCatalog {
         const Descriptions::StopsDict &stops_dict
     );
 
+    void SerializeStop(StopId stop_id, TCProto::StopResponse &proto) const;
+
+    void SerializeBus(BusId bus_id, TCProto::BusResponse &proto) const;
+
+    static void SerializeEncoded(const std::string &name, const Responses::Encoded &response,
+                                 TCProto::EncodedResponse &proto);
+
+    // Responses are put by the ids of their names in the index
+    static void DeserializeEncoded(const std::vector<std::string_view> &responses_data, const NameIndex &index,
+                                   std::vector<Responses::Encoded> &responses);
+
+    // Stops are decoded in two steps: their names are needed for the index of stops,
+    // while their buses can be resolved only with the index of buses
+    std::vector<TCProto::StopResponse> DeserializeStopNames(const std::vector<std::string_view> &stops_data);
+
+    void DeserializeStops(const std::vector<TCProto::StopResponse> &stop_protos);
+
+    void DeserializeBuses(const std::vector<std::string_view> &buses_data);
+
     Svg::Document BuildRouteMap(const TransportRouter::RouteInfo &route) const;
 
-    std::unordered_map<std::string, Stop> stops_;
-    std::unordered_map<std::string, Bus> buses_;
+    std::vector<Descriptions::InputQuery> descriptions_;
+    // Shared with the renderer, which needs names for labels
+    std::shared_ptr<const NameIndex> stops_index_;
+    std::shared_ptr<const NameIndex> buses_index_;
+    std::vector<Stop> stops_;  // by StopId
+    std::vector<Bus> buses_;   // by BusId
+    std::vector<Responses::Encoded> encoded_stops_;  // by StopId, empty if the base has none
+    std::vector<Responses::Encoded> encoded_buses_;  // by BusId, empty if the base has none
     std::unique_ptr<TransportRouter> router_;
     std::unique_ptr<MapRenderer> map_renderer_;
 };
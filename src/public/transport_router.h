@@ -3,40 +3,69 @@
 #include "descriptions.h"
 #include "graph.h"
 #include "json.h"
+#include "name_index.h"
 #include "router.h"
+#include "utils.h"
 
 #include "transport_router.pb.h"
 
 #include <memory>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// Works with stop and bus ids, names are needed only to build the router from descriptions
+// and to encode it, the base keeps names so that it doesn't depend on the ids
 class TransportRouter {
  private:
     using BusGraph = Graph::DirectedWeightedGraph<double>;
     using Router = Graph::Router<double>;
 
  public:
+    // Router of the base being updated: routes of components made of unchanged stops and buses are reused.
+    // Ids of the previous base are given by its own indices
+    struct PreviousBase {
+        const TransportRouter &router;
+        const NameIndex &stops;
+        const NameIndex &buses;
+        const std::unordered_set<std::string> &unchanged_stops;
+        const std::unordered_set<std::string> &unchanged_buses;
+    };
+
+    // Stops and buses of the dicts get their ids from the indices
     TransportRouter(const Descriptions::StopsDict &stops_dict,
                     const Descriptions::BusesDict &buses_dict,
-                    const Json::Dict &routing_settings_json);
+                    const NameIndex &stops,
+                    const NameIndex &buses,
+                    const Json::Dict &routing_settings_json,
+                    const PreviousBase *previous = nullptr);
+
+    void Serialize(TCProto::TransportRouter &proto, const NameIndex &stops, const NameIndex &buses) const;
 
-    void Serialize(TCProto::TransportRouter &proto) const;
+    // Encodes graph, routes matrix and metadata of TCProto::TransportRouter concurrently
+    std::string Serialize(SectionTimings &timings, const NameIndex &stops, const NameIndex &buses) const;
 
-    static std::unique_ptr<TransportRouter> Deserialize(const TCProto::TransportRouter &proto);
+    // Names of the base must be in the indices, std::out_of_range is thrown otherwise
+    static std::unique_ptr<TransportRouter> Deserialize(const TCProto::TransportRouter &proto,
+                                                        const NameIndex &stops, const NameIndex &buses);
+
+    // Decodes graph, routes matrix and metadata of serialized TCProto::TransportRouter concurrently
+    static std::unique_ptr<TransportRouter> Deserialize(std::string_view data, SectionTimings &timings,
+                                                        const NameIndex &stops, const NameIndex &buses);
 
     struct RouteInfo {
         double total_time;
 
         struct BusItem {
-            std::string bus_name;
+            BusId bus_id;
             double time;
             size_t start_stop_idx;
             size_t finish_stop_idx;
             size_t span_count;
         };
         struct WaitItem {
-            std::string stop_name;
+            StopId stop_id;
             double time;
         };
 
@@ -44,7 +73,7 @@ class TransportRouter {
         std::vector<Item> items;
     };
 
-    std::optional<RouteInfo> FindRoute(const std::string &stop_from, const std::string &stop_to) const;
+    std::optional<RouteInfo> FindRoute(StopId stop_from, StopId stop_to) const;
 
  private:
     TransportRouter() = default;
@@ -56,21 +85,27 @@ class TransportRouter {
 
     static RoutingSettings MakeRoutingSettings(const Json::Dict &json);
 
-    void FillGraphWithStops(const Descriptions::StopsDict &stops_dict);
+    void SerializeMetadata(TCProto::TransportRouter &proto, const NameIndex &stops, const NameIndex &buses) const;
+
+    void DeserializeMetadata(const TCProto::TransportRouter &proto, const NameIndex &stops, const NameIndex &buses);
+
+    void FillGraphWithStops(const Descriptions::StopsDict &stops_dict, const NameIndex &stops);
 
     void FillGraphWithBuses(const Descriptions::StopsDict &stops_dict,
-                            const Descriptions::BusesDict &buses_dict);
+                            const Descriptions::BusesDict &buses_dict,
+                            const NameIndex &stops,
+                            const NameIndex &buses);
 
     struct StopVertexIds {
         Graph::VertexId in;
         Graph::VertexId out;
     };
     struct VertexInfo {
-        std::string stop_name;
+        StopId stop_id;
     };
 
     struct BusEdgeInfo {
-        std::string bus_name;
+        BusId bus_id;
         size_t start_stop_idx;
         size_t finish_stop_idx;
     };
@@ -78,11 +113,21 @@ class TransportRouter {
     };
     using EdgeInfo = std::variant<BusEdgeInfo, WaitEdgeInfo>;
 
+    Router::PreviousRoutes MakePreviousRoutes(const PreviousBase &previous,
+                                              const NameIndex &stops, const NameIndex &buses) const;
+
+    struct EdgesById {
+        std::vector<Graph::EdgeId> first_bus_edges;  // by BusId, buses with less than two stops have none
+        std::vector<Graph::EdgeId> wait_edges;       // by StopId
+    };
+
+    EdgesById FindEdgesById() const;
+
     RoutingSettings routing_settings_;
     BusGraph graph_;
     // TODO: Write about this unique_ptr usage case
     std::unique_ptr<Router> router_;
-    std::unordered_map<std::string, StopVertexIds> stops_vertex_ids_;
+    std::vector<StopVertexIds> stops_vertex_ids_;  // by StopId
     std::vector<VertexInfo> vertices_info_;
     std::vector<EdgeInfo> edges_info_;
 };
@@ -1,9 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iterator>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 template<typename It>
 class Range {
@@ -42,6 +54,83 @@ const V *GetValuePointer(const std::unordered_map<K, V> &map, const K &key) {
     }
 }
 
+template<typename Func>
+std::chrono::steady_clock::duration MeasureDuration(Func func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::steady_clock::now() - start;
+}
+
+using SectionTimings = std::vector<std::pair<std::string, std::chrono::steady_clock::duration>>;
+
+size_t GetWorkerCount();
+
+// Runs func(begin, end) for contiguous chunks of [0, item_count), each chunk on its own thread,
+// and returns results in chunk order
+template<typename Func>
+auto TransformChunksParallel(size_t item_count, size_t chunk_count, Func func) {
+    using Result = decltype(func(size_t{}, size_t{}));
+    chunk_count = std::max<size_t>(1, std::min(chunk_count, item_count));
+    const size_t chunk_size = (item_count + chunk_count - 1) / chunk_count;
+    std::vector<std::future<Result>> futures;
+    for (size_t begin = 0; begin < item_count; begin += chunk_size) {
+        const size_t end = std::min(item_count, begin + chunk_size);
+        futures.push_back(std::async(std::launch::async, [&func, begin, end] { return func(begin, end); }));
+    }
+    std::vector<Result> results;
+    results.reserve(futures.size());
+    for (auto &future : futures) {
+        results.push_back(future.get());
+    }
+    return results;
+}
+
+template<typename Func>
+void ForEachChunkParallel(size_t item_count, size_t chunk_count, Func func) {
+    TransformChunksParallel(item_count, chunk_count, [&func](size_t begin, size_t end) {
+        func(begin, end);
+        return true;  // futures of void can't be collected into vector
+    });
+}
+
+// Threads started once and kept waiting for work, so that work given often doesn't pay for starting threads each time
+class ThreadPool {
+ public:
+    explicit ThreadPool(size_t thread_count);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    size_t GetThreadCount() const {
+        return threads_.size();
+    }
+
+    // Runs worker_job() on each thread of the pool while the calling thread runs caller_job(),
+    // returns once all of them are done. If caller_job throws, it must still let worker_job return.
+    // Rethrows the exception of caller_job or else the first one of worker_job. Calls from several threads take turns
+    void Run(const std::function<void()> &worker_job, const std::function<void()> &caller_job);
+
+ private:
+    void Work();
+
+    std::mutex run_mutex_;  // one Run at a time
+    std::mutex mutex_;
+    std::condition_variable job_started_;
+    std::condition_variable job_finished_;
+    const std::function<void()> *job_ = nullptr;
+    size_t job_number_ = 0;  // threads tell a new job by it
+    size_t running_count_ = 0;
+    std::exception_ptr worker_error_;
+    bool is_stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
 std::string_view Strip(std::string_view line);
 
 bool IsZero(double x);
+
+// xxHash64-style hash of 8-byte words, the same in every run and build unlike std::hash, e.g. to tell files apart
+uint64_t ComputeHash(std::string_view data);
@@ -0,0 +1,126 @@
+#include "json.h"
+#include "json_scanner.h"
+#include "json_view.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Checks Scanner::ParseNumber against strtod bit by bit, integers against their exact values,
+// and that all three parsers reject malformed numbers
+size_t failure_count = 0;
+
+void Fail(string_view text, string_view message) {
+    cerr << "\"" << text << "\": " << message << '\n';
+    ++failure_count;
+}
+
+void CheckDouble(const string &text) {
+    const auto result = Json::Scanner::ParseNumber(text);
+    if (!holds_alternative<double>(result)) {
+        Fail(text, "parsed as an integer");
+        return;
+    }
+    const double expected = strtod(text.c_str(), nullptr);
+    const double actual = get<double>(result);
+    if (memcmp(&expected, &actual, sizeof(double)) != 0) {
+        char expected_text[64], actual_text[64];
+        snprintf(expected_text, sizeof(expected_text), "%a", expected);
+        snprintf(actual_text, sizeof(actual_text), "%a", actual);
+        Fail(text, string("got ") + actual_text + " instead of " + expected_text);
+    }
+}
+
+void CheckInteger(const string &text, int64_t expected) {
+    const auto result = Json::Scanner::ParseNumber(text);
+    if (!holds_alternative<int64_t>(result)) {
+        Fail(text, "parsed as a double");
+    } else if (get<int64_t>(result) != expected) {
+        Fail(text, "got " + to_string(get<int64_t>(result)));
+    }
+}
+
+template<typename LoadFunc>
+void CheckRejected(const string &document, string_view parser_name, LoadFunc load) {
+    try {
+        load(document);
+        Fail(document, string(parser_name) + " accepted it");
+    } catch (const invalid_argument &) {
+    }
+}
+
+void CheckRejected(const string &number) {
+    const string document = "[" + number + "]";
+    CheckRejected(document, "istream", [](const string &text) {
+        istringstream input(text);
+        return Json::Load(input);
+    });
+    CheckRejected(document, "buffer", [](const string &text) { return Json::Load(string_view(text)); });
+    CheckRejected(document, "view", [](const string &text) { return Json::View::Load(text); });
+}
+
+string Format(const char *format, double value) {
+    char text[512];
+    snprintf(text, sizeof(text), format, value);
+    return text;
+}
+
+int main() {
+    // Halfway and boundary cases that need more than the fast path
+    for (const string text : {
+        "0.0", "-0.0", "0.1", "0.3", "1.5", "55.611087", "37.20829", "-37.6517", "1e23", "8.98846567431158e307",
+        "1.7976931348623157e308", "1.7976931348623158e308", "2.2250738585072011e-308", "2.2250738585072012e-308",
+        "4.9406564584124654e-324", "2.4703282292062328e-324", "1e-400", "1e400", "-1e400", "9007199254740993.0",
+        "9007199254740993e0", "123456789012345678901234567890", "0.000000000000000000000000000001e30",
+        "3.0540412e5", "1E2", "1e+2", "1e-2", "9223372036854775808", "-9223372036854775809",
+    }) {
+        CheckDouble(text);
+    }
+
+    // Same formats as coordinates usually come in, and %.17e of arbitrary doubles that round-trips every one of them
+    // (%.17g would print some as integers)
+    mt19937_64 generator(42);
+    uniform_real_distribution<double> coordinate(-180, 180);
+    uniform_int_distribution<uint64_t> bits;
+    for (int idx = 0; idx < 100000; ++idx) {
+        const double value = coordinate(generator);
+        CheckDouble(Format("%.6f", value));
+        CheckDouble(Format("%.17g", value));
+        CheckDouble(Format("%e", value));
+        double any_value;
+        const uint64_t value_bits = bits(generator);
+        memcpy(&any_value, &value_bits, sizeof(any_value));
+        if (isfinite(any_value)) {
+            CheckDouble(Format("%.17e", any_value));
+        }
+    }
+
+    CheckInteger("0", 0);
+    CheckInteger("-0", 0);
+    CheckInteger("2147483648", 2147483648);
+    CheckInteger("9007199254740993", 9007199254740993);
+    CheckInteger("9223372036854775807", numeric_limits<int64_t>::max());
+    CheckInteger("-9223372036854775808", numeric_limits<int64_t>::min());
+
+    for (const string number : {"-", "-.", "-e5", ".5", "1.", "1.e5", "1e", "1e+", "1E-", "-x"}) {
+        CheckRejected(number);
+    }
+
+    if (failure_count > 0) {
+        cerr << failure_count << " failures\n";
+        return 1;
+    }
+    return 0;
+}
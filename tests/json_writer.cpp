@@ -0,0 +1,97 @@
+#include "json.h"
+#include "json_writer.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Checks that Writer in the compatible format prints the same bytes as PrintNode,
+// and that fixed format prints big values and precisions in full like printf
+size_t failure_count = 0;
+
+void Fail(string_view what, string_view actual, string_view expected) {
+    cerr << what << ":\n  got      " << actual << "\n  expected " << expected << '\n';
+    ++failure_count;
+}
+
+void CheckCompatible(const Json::Node &node, string_view what) {
+    ostringstream expected;
+    Json::PrintNode(node, expected);
+    ostringstream actual;
+    {
+        Json::Writer writer(actual);
+        writer.Write(node);
+    }
+    if (actual.str() != expected.str()) {
+        Fail(what, actual.str(), expected.str());
+    }
+}
+
+void CheckFixed(double value, int precision) {
+    ostringstream actual;
+    {
+        Json::Writer writer(actual, Json::Writer::DoubleFormat::Fixed, precision);
+        writer.Write(value);
+    }
+    string expected(precision + 400, '\0');
+    expected.resize(snprintf(expected.data(), expected.size(), "%.*f", precision, value));
+    if (actual.str() != expected) {
+        Fail("fixed " + to_string(precision), actual.str(), expected);
+    }
+}
+
+int main() {
+    const double max_double = numeric_limits<double>::max();
+    Json::Array values = {
+        Json::Node(0.0), Json::Node(-0.0), Json::Node(0.1), Json::Node(1e-7), Json::Node(123456.5),
+        Json::Node(1234567.0), Json::Node(1e21), Json::Node(max_double), Json::Node(-max_double),
+        Json::Node(numeric_limits<double>::denorm_min()), Json::Node(numeric_limits<double>::infinity()),
+        Json::Node(int64_t{0}), Json::Node(int64_t{-42}), Json::Node(numeric_limits<int64_t>::max()),
+        Json::Node(numeric_limits<int64_t>::min()), Json::Node(true), Json::Node(false),
+        Json::Node(string("")), Json::Node(string("plain")), Json::Node(string("quote \" and backslash \\")),
+        Json::Node(string("controls \n\t\r\b\f\x01\x1f end")), Json::Node(string("\xd0\x9c\xd0\xb8\xd1\x80 \x7f")),
+    };
+    for (size_t idx = 0; idx < values.size(); ++idx) {
+        CheckCompatible(values[idx], "value " + to_string(idx));
+    }
+    CheckCompatible(Json::Node(Json::Dict{
+        {"array", Json::Node(values)},
+        {"empty array", Json::Node(Json::Array{})},
+        {"empty dict", Json::Node(Json::Dict{})},
+        {"nested", Json::Node(Json::Dict{{"key \"with\" quotes\n", Json::Node(Json::Array{Json::Node(1.5)})}})},
+    }), "document");
+
+    mt19937_64 generator(42);
+    uniform_int_distribution<uint64_t> bits;
+    uniform_real_distribution<double> coordinate(-180, 180);
+    for (int idx = 0; idx < 100000; ++idx) {
+        double value;
+        const uint64_t value_bits = bits(generator);
+        memcpy(&value, &value_bits, sizeof(value));
+        if (isfinite(value)) {
+            CheckCompatible(Json::Node(value), "random double");
+        }
+        CheckCompatible(Json::Node(coordinate(generator)), "random coordinate");
+    }
+
+    for (const int precision : {0, 6, 17, 400, 1000}) {
+        for (const double value : {0.0, 1.0 / 3, -2.5e-300, 1e300, -max_double, max_double}) {
+            CheckFixed(value, precision);
+        }
+    }
+
+    if (failure_count > 0) {
+        cerr << failure_count << " failures\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+# Builds the base of CASE_DIR/make_base.json with BINARY, answers CASE_DIR/process_requests.json from it
+# and compares the output with CASE_DIR/expected.json. Runs in the directory the base is written to
+foreach (mode make_base process_requests)
+    execute_process(
+            COMMAND ${BINARY} ${mode} --input=${CASE_DIR}/${mode}.json
+            OUTPUT_VARIABLE output
+            RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${mode} failed: ${result}")
+    endif ()
+endforeach ()
+
+file(READ ${CASE_DIR}/expected.json expected)
+string(STRIP "${output}" output)
+string(STRIP "${expected}" expected)
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "unexpected output:\n${output}\nexpected:\n${expected}")
+endif ()